@@ -6,7 +6,6 @@
 
 bool output_csv = false;
 FILE *logs;
-cpuinfo info;
 
 /* x64 regisuter usage
  *  http://msdn.microsoft.com/en-US/library/9z1stfyw(v=vs.80).aspx
@@ -37,57 +36,330 @@ cpuinfo info;
 #include <linux/perf_event.h>
 #include <asm/unistd.h>
 #include <sys/eventfd.h>
+#include <sched.h>
 
-static int
-perf_event_open(struct perf_event_attr *hw_event, pid_t pid,
-                int cpu, int group_fd, unsigned long flags )
+/*
+ * RAPL energy counters.
+ *  perf "power" pmu (energy-pkg, energy-cores), system wide on the current cpu
+ *  fallback : /sys/class/powercap/intel-rapl:0 (pkg), intel-rapl:0:0 (cores)
+ * both usually need root or perf_event_paranoid <= 0, and are absent in most VMs.
+ */
+static int energy_fd[2] = {-1, -1};
+static double energy_scale[2];
+static const char *energy_event[2] = {"energy-pkg", "energy-cores"};
+static const char *energy_powercap[2] = {
+    "/sys/class/powercap/intel-rapl:0/energy_uj",
+    "/sys/class/powercap/intel-rapl:0:0/energy_uj",
+};
+static bool energy_use_powercap[2];
+
+static bool
+read_sysfs(const char *path, char *buf, size_t len)
+{
+    FILE *fp = fopen(path, "r");
+    if (fp == NULL) {
+        return false;
+    }
+
+    bool ok = fgets(buf, len, fp) != NULL;
+    fclose(fp);
+    return ok;
+}
+
+static void
+energy_init(void)
+{
+    char path[256], buf[256];
+    int type = -1;
+
+    if (read_sysfs("/sys/bus/event_source/devices/power/type", buf, sizeof(buf))) {
+        type = atoi(buf);
+    }
+
+    for (int i=0; i<2; i++) {
+        unsigned int config;
+
+        snprintf(path, sizeof(path), "/sys/bus/event_source/devices/power/events/%s", energy_event[i]);
+        if (type != -1 &&
+            read_sysfs(path, buf, sizeof(buf)) &&
+            sscanf(buf, "event=%x", &config) == 1)
+        {
+            strcat(path, ".scale");
+            energy_scale[i] = 2.3283064365386962890625e-10; /* 2^-32 J */
+            if (read_sysfs(path, buf, sizeof(buf))) {
+                energy_scale[i] = atof(buf);
+            }
+
+            struct perf_event_attr attr;
+            memset(&attr, 0, sizeof(attr));
+            attr.type = type;
+            attr.size = sizeof(attr);
+            attr.config = config;
+
+            energy_fd[i] = perf_event_open(&attr, -1, sched_getcpu(), -1, 0);
+            if (energy_fd[i] != -1) {
+                continue;
+            }
+        }
+
+        energy_fd[i] = open(energy_powercap[i], O_RDONLY);
+        if (energy_fd[i] != -1) {
+            energy_use_powercap[i] = true;
+            energy_scale[i] = 1e-6;
+        }
+    }
+
+    if (energy_fd[0] == -1 && energy_fd[1] == -1) {
+        fprintf(stderr, "energy : RAPL is not available, energy columns are nan\n");
+    }
+}
+
+void
+read_energy(double *pkg, double *cores)
+{
+    double v[2];
+
+    for (int i=0; i<2; i++) {
+        v[i] = NAN;
+
+        if (energy_fd[i] == -1) {
+            continue;
+        }
+
+        if (energy_use_powercap[i]) {
+            char buf[64];
+            ssize_t sz = pread(energy_fd[i], buf, sizeof(buf)-1, 0);
+            if (sz > 0) {
+                buf[sz] = '\0';
+                v[i] = strtoull(buf, NULL, 10) * energy_scale[i];
+            }
+        } else {
+            long long val;
+            if (read(energy_fd[i], &val, sizeof(val)) == sizeof(val)) {
+                v[i] = val * energy_scale[i];
+            }
+        }
+    }
+
+    *pkg = v[0];
+    *cores = v[1];
+}
+
+#else
+
+static void
+energy_init(void)
 {
-    int ret;
+    fprintf(stderr, "energy : RAPL is not available, energy columns are nan\n");
+}
 
-    ret = syscall( __NR_perf_event_open, hw_event, pid, cpu,
-                   group_fd, flags );
-    return ret;
+void
+read_energy(double *pkg, double *cores)
+{
+    *pkg = NAN;
+    *cores = NAN;
 }
 
-int perf_fd;
+#endif
+
+bool align_sweep = false;
+bool energy_mode = false;
+bool smt_mode = false;
+const char *emit_header = NULL;
+const char *dump_path = "out.bin";
+static const char *snippet_file = NULL;
+static bool incremental = false;
+static long long cache_ttl = 30;        /* days */
+static bool parallel_mode = false;
+static const char *smt_pair = NULL;
+static const char *sysfs_root = NULL;
+const char *core_tag = NULL;
 
 static void
-cycle_counter_init(void)
+test_misc()
 {
-    struct perf_event_attr attr;
-    memset(&attr, 0, sizeof(attr));
+    if (info.have_popcnt) {
+        GEN(Reg64, "popcnt", (g->popcnt(dst, src)), false, OT_INT);
+    }
+
+    test_bmi();
+
+    if (info.have_aes) {
+        GEN(Xmm, "aesenc", (g->aesenc(dst,src)), false, OT_INT);
+        GEN(Xmm, "aesenclast", (g->aesenclast(dst,src)), false, OT_INT);
+        GEN(Xmm, "aesdec", (g->aesdec(dst,src)), false, OT_INT);
+        GEN(Xmm, "aesdeclast", (g->aesdeclast(dst,src)), false, OT_INT);
+    }
+
+    if (info.have_pclmulqdq) {
+        GEN(Xmm, "pclmulqdq", (g->pclmulqdq(dst,src,0)), false, OT_INT);
+    }
+}
 
-    attr.type = PERF_TYPE_HARDWARE;
-    attr.size = sizeof(attr);
-    attr.config = PERF_COUNT_HW_CPU_CYCLES;
-    attr.exclude_kernel = 1;
+static const suite suites[] = {
+    {"generic", test_generic, false},
+    {"sse", test_sse, false},
+    {"avx", test_avx, false},
+    {"avx512", test_avx512, false},
+    {"fence", test_fence, false},
+    {"rename", test_rename, false},
+    {"partial", test_partial, false},
+    {"fusion", test_fusion, false},
+    {"bypass", test_bypass, false},
+    {"memport", test_memport, false},
+    {"tlb", test_tlb, true},
+    {"mlp", test_mlp, true},
+    {"rob", test_rob, true},
+    {"conv", test_conv, false},
+    {"transition", test_transition, false},
+    {"strops", test_strops, true},
+    {"misc", test_misc, false},
+    {"smt", test_smt, true},
+};
 
-    perf_fd = perf_event_open(&attr, 0, -1, -1, 0);
-    if (perf_fd == -1) {
+static void
+counters_init(bool want_uops)
+{
+    if (!ib_counters_init(want_uops)) {
         perror("perf_event_open");
         exit(1);
     }
 }
 
-#else
+/* forked workers need their own counters */
+static void
+worker_init(void)
+{
+    counters_init(uops_fd != -1);
+}
+
+static void
+run_suites(bool smt_requested)
+{
+    int num_suite = sizeof(suites)/sizeof(suites[0]);
 
-#define cycle_counter_init() ((void)0)
+    smt_mode = smt_requested && smt_init(smt_pair);
 
-#endif
+    if (parallel_mode) {
+        run_parallel(suites, num_suite, worker_init);
+    } else {
+        for (int i=0; i<num_suite; i++) {
+            suites[i].run();
+        }
+    }
+}
+
+/*
+ * hybrid cpus : the whole table runs once per core type, pinned to the
+ * cpus of that type, with counters on that type's pmu. rows are tagged
+ * with the type name.
+ */
+static void
+run_hybrid(core_type *types, int num_type, bool smt_requested)
+{
+#ifdef __linux
+    cpu_set_t orig;
+    sched_getaffinity(0, sizeof(orig), &orig);
+
+    for (int ti=0; ti<num_type; ti++) {
+        core_type *t = &types[ti];
+        cpu_set_t set;
+        CPU_ZERO(&set);
+
+        for (int i=0; i<t->num_cpu; i++) {
+            if (t->cpus[i] < CPU_SETSIZE && CPU_ISSET(t->cpus[i], &orig)) {
+                CPU_SET(t->cpus[i], &set);
+            }
+        }
 
-char MIE_ALIGN(2048*1024) zero_mem[4096*1024];
-char MIE_ALIGN(2048*1024) data_mem[4096*1024];
+        if (CPU_COUNT(&set) == 0 || sched_setaffinity(0, sizeof(set), &set) != 0) {
+            fprintf(stderr, "hybrid : no usable cpu for %s, skipped\n", t->name);
+            continue;
+        }
+
+        if (!output_csv) {
+            printf("== %s (%d cpus) ==\n", t->name, CPU_COUNT(&set));
+        }
+
+        core_tag = t->name;
+        cycle_pmu_type = t->pmu_type;
+
+        /* UOPS_ISSUED.ANY encoding is only known for the big core */
+        counters_init(strcmp(t->name, "cpu_core") == 0);
+
+        run_suites(smt_requested);
+    }
+
+    sched_setaffinity(0, sizeof(orig), &orig);
+    core_tag = NULL;
+#else
+    (void)types;
+    (void)num_type;
+    run_suites(smt_requested);
+#endif
+}
 
 int
 main(int argc, char **argv)
 {
-    if (argc >= 2) {
-        if (strcmp(argv[1],"--csv") == 0) {
+    for (int i=1; i<argc; i++) {
+        if (strcmp(argv[i],"--csv") == 0) {
             output_csv = true;
+        } else if (strcmp(argv[i],"--align-sweep") == 0) {
+            align_sweep = true;
+        } else if (strcmp(argv[i],"--energy") == 0) {
+            energy_mode = true;
+        } else if (strcmp(argv[i],"--parallel") == 0) {
+            parallel_mode = true;
+        } else if (strcmp(argv[i],"--smt") == 0) {
+            smt_mode = true;
+        } else if (strncmp(argv[i],"--smt-pair=",11) == 0) {
+            smt_mode = true;
+            smt_pair = argv[i] + 11;
+        } else if (strncmp(argv[i],"--sysfs-root=",13) == 0) {
+            sysfs_root = argv[i] + 13;
+        } else if (strcmp(argv[i],"--emit-header") == 0 && i+1 < argc) {
+            emit_header = argv[++i];
+        } else if (strcmp(argv[i],"--snippet") == 0 && i+1 < argc) {
+            snippet_file = argv[++i];
+        } else if (strcmp(argv[i],"--incremental") == 0) {
+            incremental = true;
+        } else if (strncmp(argv[i],"--cache-ttl=",12) == 0) {
+            cache_ttl = atoll(argv[i] + 12);
         }
     }
 
-    cycle_counter_init();
+    if (parallel_mode && smt_mode) {
+        /* co-run needs the sibling threads that --parallel leaves idle */
+        fprintf(stderr, "--smt can't be used with --parallel, running serially\n");
+        parallel_mode = false;
+    }
+
+    if (parallel_mode && emit_header) {
+        /* rows are collected in this process */
+        fprintf(stderr, "--emit-header can't be used with --parallel, running serially\n");
+        parallel_mode = false;
+    }
+
+    if (parallel_mode && incremental) {
+        /* the cache is read and written in this process */
+        fprintf(stderr, "--incremental can't be used with --parallel, running serially\n");
+        parallel_mode = false;
+    }
+
+    if (parallel_mode && energy_mode) {
+        /* RAPL is package wide */
+        fprintf(stderr, "--energy can't be used with --parallel, running serially\n");
+        parallel_mode = false;
+    }
+
+    if (!ib_init()) {
+        perror("perf_event_open");
+        exit(1);
+    }
+    if (energy_mode) {
+        energy_init();
+    }
 
 #ifdef _WIN32
 #define x_cpuid(p,eax) __cpuid(p, eax)
@@ -104,6 +376,8 @@ main(int argc, char **argv)
 
 #endif
 
+    char brand[4*3*4+1];
+
     {
         cpuid_t data[4*3+1];
         char data_nospace[4*3*4+1];
@@ -113,6 +387,7 @@ main(int argc, char **argv)
         x_cpuid(data+4*2, 0x80000004);
         data[12] = 0;
         puts((char*)data);
+        snprintf(brand, sizeof(brand), "%s", (char*)data);
 
         char *d0 = (char*)data;
         int out = 0;
@@ -125,7 +400,8 @@ main(int argc, char **argv)
         data_nospace[out] = '\0';
 
         path += data_nospace;
-        path += ".csv";
+        /* snippet rows are not the full table, keep them out of <brand>.csv */
+        path += snippet_file ? ".snippet.csv" : ".csv";
     }
 
     logs = fopen(path.c_str(), "wb");
@@ -134,100 +410,41 @@ main(int argc, char **argv)
         return 1;
     }
     fprintf(logs, 
-            "class,inst,l/t,cpi,ipc\n");
+            "class,inst,l/t,cpi,ipc,quality,source\n");
 
-    if (!output_csv) {
-        printf("== latency/throughput ==\n");
+    run_meta meta;
+    run_meta_init(&meta, brand);
+    if (!snippet_file) {
+        run_meta_write((path + ".meta").c_str(), &meta);
     }
 
-    {
-        int reg[4];
-
-#ifdef _WIN32
-        __cpuidex(reg, 7, 0);
-#else
-        __cpuid_count(7, 0, reg[0], reg[1], reg[2], reg[3]);
-#endif
-
-        if (reg[1] & (1<<5)) {
-            info.have_avx2 = true;
-        }
-
-        if (reg[1] & (1<<16)) {
-            info.have_avx512f = true;
-        }
-
-        if (reg[1] & (1<<27)) {
-            info.have_avx512er = true;
-        }
-
-#ifdef _WIN32
-        __cpuid(reg, 1);
-#else
-        __cpuid(1, reg[0], reg[1], reg[2], reg[3]);
-#endif
-        if (reg[2] & (1<<1)) {
-            info.have_pclmulqdq = true;
-        }
-
-        if (reg[2] & (1<<12)) {
-            info.have_fma = true;
-        }
-
-
-        if (reg[2] & (1<<20)) {
-            info.have_sse42 = true;
-        }
-
-        if (reg[2] & (1<<28)) {
-            info.have_avx = true;
-        }
-
-        if (reg[2] & (1<<23)) {
-            info.have_popcnt = true;
-        }
-
-        if (reg[2] & (1<<25)) {
-            info.have_aes = true;
-        }
-
-        if (info.have_avx512f) {
-            if (reg[2] & (1<<11)) {
-                info.have_avx512vnni = true;
-            }
-        }
-
-#ifdef _WIN32
-        __cpuidex(reg, 7, 1);
-#else
-        __cpuid_count(7, 1, reg[0], reg[1], reg[2], reg[3]);
-#endif
-
-        if (reg[0] & (1<<5)) {
-            info.have_avx512bf16 = true;
-        }
-
+    if (!parallel_mode && !snippet_file) {
+        cache_open((path.substr(0, path.size() - 4) + ".cache").c_str(), &meta,
+                   incremental, cache_ttl * 24 * 60 * 60);
     }
 
-    test_generic();
-    test_sse();
-    test_avx();
-    test_avx512();
-
-    if (info.have_popcnt) {
-        GEN(Reg64, "popcnt", (g->popcnt(dst, src)), false, OT_INT);
+    if (!output_csv) {
+        printf("== latency/throughput ==\n");
     }
 
-    if (info.have_aes) {
-        GEN(Xmm, "aesenc", (g->aesenc(dst,src)), false, OT_INT);
-        GEN(Xmm, "aesenclast", (g->aesenclast(dst,src)), false, OT_INT);
-        GEN(Xmm, "aesdec", (g->aesdec(dst,src)), false, OT_INT);
-        GEN(Xmm, "aesdeclast", (g->aesdeclast(dst,src)), false, OT_INT);
-    }
+    static core_type types[HYBRID_MAX_TYPE];
+    int num_type = hybrid_topology(sysfs_root, types, HYBRID_MAX_TYPE);
 
-    if (info.have_pclmulqdq) {
-        GEN(Xmm, "pclmulqdq", (g->pclmulqdq(dst,src,0)), false, OT_INT);
+    if (snippet_file) {
+        if (!run_snippet_file(snippet_file)) {
+            fclose(logs);
+            return 1;
+        }
+    } else if (num_type >= 2) {
+        run_hybrid(types, num_type, smt_mode);
+    } else {
+        run_suites(smt_mode);
     }
 
     fclose(logs);
+    cache_write();
+
+    if (emit_header && !costtable_write(emit_header, brand)) {
+        return 1;
+    }
 }
@@ -0,0 +1,92 @@
+#include "common.hpp"
+
+/*
+ * BMI1/BMI2/LZCNT bit manipulation
+ *
+ * Instructions taking a third operand (bextr/bzhi control, shift count,
+ * pdep/pext mask) read it from rax. rax is loaded once at the top of the
+ * loop body, outside the measured dependency chain.
+ *
+ * pdep/pext are microcoded on Zen1/Zen2 and their cost grows with the
+ * number of set bits in the mask, so they are measured with masks of
+ * several popcounts (set bits spread evenly over 64bit).
+ */
+
+typedef void (*bmi_emit_t)(Xbyak::CodeGenerator *g, Xbyak::Reg64 dst, Xbyak::Reg64 src);
+
+struct bmi_op {
+    bmi_emit_t emit;
+    uint64_t aux;
+    bool loaded;
+
+    void operator()(Xbyak::CodeGenerator *g, Xbyak::Reg64 dst, Xbyak::Reg64 src) {
+        if (!loaded) {
+            g->mov(g->rax, aux);
+            loaded = true;
+        }
+        emit(g, dst, src);
+    }
+};
+
+static void
+run_bmi(const char *name, uint64_t aux, bmi_emit_t emit)
+{
+    bmi_op f = {emit, aux, false};
+    run<Xbyak::Reg64>(name, f, false, OT_INT);
+}
+
+#define GEN_bmi(name, v, expr)                                          \
+    run_bmi(name, v,                                                    \
+            [](Xbyak::CodeGenerator *g, Xbyak::Reg64 dst, Xbyak::Reg64 src){expr;});
+
+static uint64_t
+spread_mask(int popcnt)
+{
+    uint64_t m = 0;
+    for (int i=0; i<popcnt; i++) {
+        m |= 1ULL << (i * 64 / popcnt);
+    }
+    return m;
+}
+
+void test_bmi()
+{
+    if (info.have_bmi1) {
+        GEN(Reg64, "andn", (g->andn(dst, dst, src)), false, OT_INT);
+        GEN(Reg64, "blsr", (g->blsr(dst, src)), false, OT_INT);
+        GEN(Reg64, "blsi", (g->blsi(dst, src)), false, OT_INT);
+        GEN(Reg64, "blsmsk", (g->blsmsk(dst, src)), false, OT_INT);
+        GEN(Reg64, "tzcnt", (g->tzcnt(dst, src)), false, OT_INT);
+
+        /* start=4, len=32 */
+        GEN_bmi("bextr", 0x2004, (g->bextr(dst, src, g->rax)));
+    }
+
+    if (info.have_lzcnt) {
+        GEN(Reg64, "lzcnt", (g->lzcnt(dst, src)), false, OT_INT);
+    }
+
+    if (info.have_bmi2) {
+        GEN_bmi("bzhi", 32, (g->bzhi(dst, src, g->rax)));
+        GEN_bmi("shlx", 5, (g->shlx(dst, src, g->rax)));
+        GEN_bmi("sarx", 5, (g->sarx(dst, src, g->rax)));
+        GEN_bmi("shrx", 5, (g->shrx(dst, src, g->rax)));
+        GEN(Reg64, "rorx", (g->rorx(dst, src, 7)), false, OT_INT);
+
+        /* rdx (zero_mem) is the implicit multiplicand. low half goes to rsi */
+        GEN(Reg64, "mulx", (g->mulx(dst, g->rsi, src)), false, OT_INT);
+
+        static const int popcnts[] = {0, 1, 8, 16, 32, 48, 64};
+        char name[128];
+
+        for (size_t i=0; i<sizeof(popcnts)/sizeof(popcnts[0]); i++) {
+            uint64_t mask = spread_mask(popcnts[i]);
+
+            snprintf(name, sizeof(name), "pdep (mask popcnt=%d)", popcnts[i]);
+            GEN_bmi(name, mask, (g->pdep(dst, src, g->rax)));
+
+            snprintf(name, sizeof(name), "pext (mask popcnt=%d)", popcnts[i]);
+            GEN_bmi(name, mask, (g->pext(dst, src, g->rax)));
+        }
+    }
+}
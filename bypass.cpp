@@ -0,0 +1,98 @@
+#include "common.hpp"
+
+/*
+ * bypass delay between execution domains
+ *
+ * Every producer->consumer pair is measured as a latency chain
+ *
+ *     producer v8, v8
+ *     consumer v8, v8
+ *
+ * and "bypass" is the pair latency minus the sum of the standalone
+ * latencies. The chain closes back into the producer, so the value is
+ * the round trip (producer->consumer + consumer->producer) and each
+ * unordered pair is measured once, as "p<->c".
+ */
+
+template <typename RegType>
+struct domain {
+    const char *name;
+    void (*op)(Xbyak::CodeGenerator *g, RegType dst, RegType src);
+    enum operand_type ot;
+};
+
+template <typename RegType>
+struct domain_pair {
+    const domain<RegType> *p, *c;
+
+    void operator()(Xbyak::CodeGenerator *g, RegType dst, RegType src) {
+        p->op(g, dst, src);
+        c->op(g, dst, src);
+    }
+};
+
+template <typename RegType>
+static void
+run_bypass(const domain<RegType> *d, int num_domain)
+{
+    const char *class_name = RegMap<RegType>().name;
+    double lat[16];
+    char name[128];
+
+    for (int i=0; i<num_domain; i++) {
+        lat[i] = lt<RegType>(d[i].name, "latency", d[i].op, false, NUM_LOOP, LT_LATENCY, d[i].ot).cpi;
+    }
+
+    for (int pi=0; pi<num_domain; pi++) {
+        for (int ci=pi+1; ci<num_domain; ci++) {
+            domain_pair<RegType> f = {&d[pi], &d[ci]};
+            snprintf(name, sizeof(name), "%s<->%s", d[pi].name, d[ci].name);
+
+            double pair = lt<RegType>(name, "latency", f, false, NUM_LOOP, LT_LATENCY, d[pi].ot).cpi;
+            report_value(class_name, name, "bypass", pair - (lat[pi] + lat[ci]));
+        }
+    }
+}
+
+#define DOMAIN(rt, name, expr, ot) \
+    { name, [](Xbyak::CodeGenerator *g, Xbyak::rt dst, Xbyak::rt src){expr;}, ot }
+
+void test_bypass()
+{
+    using namespace Xbyak;
+
+    {
+        static const domain<Xmm> d[] = {
+            DOMAIN(Xmm, "paddd", (g->paddd(dst, src)), OT_INT),
+            DOMAIN(Xmm, "pand", (g->pand(dst, src)), OT_INT),
+            DOMAIN(Xmm, "pshufd", (g->pshufd(dst, src, 0)), OT_INT),
+            DOMAIN(Xmm, "addps", (g->addps(dst, src)), OT_FP32),
+            DOMAIN(Xmm, "addpd", (g->addpd(dst, src)), OT_FP64),
+            DOMAIN(Xmm, "andps", (g->andps(dst, src)), OT_FP32),
+            DOMAIN(Xmm, "shufps", (g->shufps(dst, src, 0)), OT_FP32),
+        };
+        run_bypass<Xmm>(d, sizeof(d)/sizeof(d[0]));
+    }
+
+    if (info.have_avx2) {
+        static const domain<Ymm> d[] = {
+            DOMAIN(Ymm, "vpaddd", (g->vpaddd(dst, dst, src)), OT_INT),
+            DOMAIN(Ymm, "vpand", (g->vpand(dst, dst, src)), OT_INT),
+            DOMAIN(Ymm, "vpshufd", (g->vpshufd(dst, src, 0)), OT_INT),
+            DOMAIN(Ymm, "vaddps", (g->vaddps(dst, dst, src)), OT_FP32),
+            DOMAIN(Ymm, "vaddpd", (g->vaddpd(dst, dst, src)), OT_FP64),
+            DOMAIN(Ymm, "vandps", (g->vandps(dst, dst, src)), OT_FP32),
+            DOMAIN(Ymm, "vshufps", (g->vshufps(dst, dst, src, 0)), OT_FP32),
+        };
+        run_bypass<Ymm>(d, sizeof(d)/sizeof(d[0]));
+    } else if (info.have_avx) {
+        /* no 256bit integer ops */
+        static const domain<Ymm> d[] = {
+            DOMAIN(Ymm, "vaddps", (g->vaddps(dst, dst, src)), OT_FP32),
+            DOMAIN(Ymm, "vaddpd", (g->vaddpd(dst, dst, src)), OT_FP64),
+            DOMAIN(Ymm, "vandps", (g->vandps(dst, dst, src)), OT_FP32),
+            DOMAIN(Ymm, "vshufps", (g->vshufps(dst, dst, src, 0)), OT_FP32),
+        };
+        run_bypass<Ymm>(d, sizeof(d)/sizeof(d[0]));
+    }
+}
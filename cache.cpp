@@ -0,0 +1,226 @@
+#include "common.hpp"
+#include <time.h>
+
+/*
+ * result cache of lt() rows (<csv without .csv>.cache)
+ *
+ *   key signature=0x000506e3 microcode=0xf0 kernel=6.1.0-18-amd64 build=3315923482
+ *   m256<TAB>vaddps<TAB>latency<TAB>9c1b4f0e12d7a385<TAB>1760870400<TAB>cpi<TAB>ipc<TAB>upi<TAB>ok
+ *
+ * The key line is the host the rows are valid for : cpuid signature,
+ * microcode, kernel and IB_BUILD_HASH (checksum of the measurement core
+ * and compiler, set by the Makefile). A file with another key is
+ * dropped. Each row carries the ib_definition_hash of the kernel that was
+ * measured and the date.
+ *
+ * With --incremental, lt() takes a row from the cache when class, inst,
+ * l/t and definition hash match and the row is younger than the ttl
+ * (--cache-ttl=DAYS). Disturbed rows are always re-measured. Every run
+ * writes the cache back, so a full run fills it for the next incremental
+ * one.
+ *
+ * Only lt() rows are cached. Suites that time their own loops (mlp, rob,
+ * tlb, ...) and derived values are measured every time.
+ */
+
+#ifndef IB_BUILD_HASH
+#define IB_BUILD_HASH "unknown"
+#endif
+
+#define CACHE_MAX 16384
+
+struct cache_entry {
+    char class_name[64];
+    char inst[128];
+    char on[32];
+    unsigned long long def;
+    long long date;
+    lt_result r;
+};
+
+static cache_entry entries[CACHE_MAX];
+static int num_entry;
+
+static char cache_path[1024];
+static char cache_key[512];
+static bool cache_incremental;
+static long long cache_ttl;
+static long long cache_now;
+
+bool cache_active = false;
+
+static enum ib_quality
+quality_from_name(const char *name)
+{
+    if (strcmp(name, "ok") == 0) {
+        return IB_CLEAN;
+    } else if (strcmp(name, "retried") == 0) {
+        return IB_RETRIED;
+    } else if (strcmp(name, "disturbed") == 0) {
+        return IB_DISTURBED;
+    }
+    return IB_UNCHECKED;
+}
+
+/* splits line at tabs in place. returns the number of fields */
+static int
+split_tab(char *line, char **fields, int max)
+{
+    int n = 0;
+
+    line[strcspn(line, "\r\n")] = '\0';
+    while (n < max) {
+        fields[n++] = line;
+        line = strchr(line, '\t');
+        if (line == NULL) {
+            break;
+        }
+        *line++ = '\0';
+    }
+
+    return n;
+}
+
+static cache_entry *
+find_entry(const char *class_name, const char *inst, const char *on)
+{
+    for (int i=0; i<num_entry; i++) {
+        cache_entry *e = &entries[i];
+        if (strcmp(e->inst, inst) == 0 && strcmp(e->on, on) == 0 && strcmp(e->class_name, class_name) == 0) {
+            return e;
+        }
+    }
+    return NULL;
+}
+
+static void
+load(FILE *fp)
+{
+    char line[1024];
+    char *f[9];
+
+    if (fgets(line, sizeof(line), fp) == NULL) {
+        return;
+    }
+    line[strcspn(line, "\r\n")] = '\0';
+    if (strcmp(line, cache_key) != 0) {
+        fprintf(stderr, "cache : %s is for another cpu/microcode/kernel/build, ignored\n", cache_path);
+        return;
+    }
+
+    while (fgets(line, sizeof(line), fp) && num_entry < CACHE_MAX) {
+        if (split_tab(line, f, 9) != 9) {
+            continue;
+        }
+
+        cache_entry *e = &entries[num_entry++];
+        snprintf(e->class_name, sizeof(e->class_name), "%s", f[0]);
+        snprintf(e->inst, sizeof(e->inst), "%s", f[1]);
+        snprintf(e->on, sizeof(e->on), "%s", f[2]);
+        e->def = strtoull(f[3], NULL, 16);
+        e->date = strtoll(f[4], NULL, 10);
+        e->r.cpi = strtod(f[5], NULL);
+        e->r.ipc = strtod(f[6], NULL);
+        e->r.upi = strtod(f[7], NULL);
+        e->r.quality = quality_from_name(f[8]);
+    }
+}
+
+void
+cache_open(const char *path, const run_meta *m, bool incremental, long long ttl)
+{
+    snprintf(cache_path, sizeof(cache_path), "%s", path);
+    snprintf(cache_key, sizeof(cache_key), "key signature=0x%08x microcode=%s kernel=%s build=%s",
+             m->signature, m->microcode, m->kernel, IB_BUILD_HASH);
+
+    cache_incremental = incremental;
+    cache_ttl = ttl;
+    cache_now = time(NULL);
+    num_entry = 0;
+
+    FILE *fp = fopen(path, "rb");
+    if (fp) {
+        load(fp);
+        fclose(fp);
+    } else if (incremental) {
+        fprintf(stderr, "cache : no %s, measuring everything\n", path);
+    }
+
+    cache_active = true;
+}
+
+bool
+cache_find(const char *class_name, const char *inst, const char *on,
+           unsigned long long def, lt_result *r)
+{
+    if (!cache_incremental) {
+        return false;
+    }
+
+    cache_entry *e = find_entry(class_name, inst, on);
+    if (e == NULL || e->def != def || e->r.quality == IB_DISTURBED) {
+        return false;
+    }
+    if (cache_now - e->date > cache_ttl) {
+        return false;
+    }
+
+    *r = e->r;
+    r->cached = true;
+    return true;
+}
+
+void
+cache_store(const char *class_name, const char *inst, const char *on,
+            unsigned long long def, const lt_result &r)
+{
+    cache_entry *e = find_entry(class_name, inst, on);
+
+    if (e == NULL) {
+        if (num_entry == CACHE_MAX) {
+            fprintf(stderr, "cache : more than %d rows, %s not cached\n", CACHE_MAX, inst);
+            return;
+        }
+
+        e = &entries[num_entry++];
+        snprintf(e->class_name, sizeof(e->class_name), "%s", class_name);
+        snprintf(e->inst, sizeof(e->inst), "%s", inst);
+        snprintf(e->on, sizeof(e->on), "%s", on);
+    }
+
+    e->def = def;
+    e->date = time(NULL);
+    e->r = r;
+}
+
+bool
+cache_write(void)
+{
+    if (!cache_active) {
+        return true;
+    }
+
+    FILE *fp = fopen(cache_path, "wb");
+    if (fp == NULL) {
+        perror(cache_path);
+        return false;
+    }
+
+    fprintf(fp, "%s\n", cache_key);
+
+    for (int i=0; i<num_entry; i++) {
+        cache_entry *e = &entries[i];
+
+        /* names with tabs or newlines can't be read back */
+        if (strpbrk(e->inst, "\t\r\n") || strpbrk(e->class_name, "\t\r\n")) {
+            continue;
+        }
+
+        fprintf(fp, "%s\t%s\t%s\t%016llx\t%lld\t%.17g\t%.17g\t%.17g\t%s\n",
+                e->class_name, e->inst, e->on, e->def, e->date,
+                e->r.cpi, e->r.ipc, e->r.upi, ib_quality_name(e->r.quality));
+    }
+
+    fclose(fp);
+    return true;
+}
@@ -3,543 +3,356 @@
 
 #include <xbyak.h>
 #include <string.h>
+#include <math.h>
+#include <chrono>
+#include "ibench.hpp"
 
-struct cpuinfo {
-    bool have_sse42 = false;
-    bool have_avx = false;
-    bool have_avx2 = false;
-    bool have_fma = false;
-    bool have_avx512f = false;
-    bool have_avx512er = false;
-    bool have_avx512vnni = false;
-    bool have_avx512bf16 = false;
-    bool have_popcnt = false;
-    bool have_aes = false;
-    bool have_pclmulqdq = false;
-};
-
-extern cpuinfo info;
 extern bool output_csv;
 extern FILE *logs;
-extern int perf_fd;
-
-#ifdef __linux
-
-#include <unistd.h>
-#include <fcntl.h>
-#include <sys/syscall.h>
-#include <linux/perf_event.h>
-#include <asm/unistd.h>
-#include <sys/eventfd.h>
+extern const char *dump_path;   /* generated code of the last lt(), "out.<pid>.bin" in --parallel workers */
 
+/* read_cycle() of the library returns -1 on error, bench gives up */
 static inline long long
-read_cycle(void)
+read_cycle_or_exit(void)
 {
-    long long val;
-    ssize_t sz = read(perf_fd, &val, sizeof(val));
-    if (sz != sizeof(val)) {
+    long long v = read_cycle();
+    if (v < 0) {
         perror("read");
         exit(1);
     }
-
-    return val;
+    return v;
 }
+extern bool align_sweep;        /* --align-sweep */
+extern bool energy_mode;        /* --energy */
+extern bool smt_mode;           /* --smt */
 
-#else
-
-#define read_cycle() __rdtsc()
-
-
-#endif
+extern bool smt_init(const char *pair);
+/* runs a (and b, if not NULL) on the two sibling threads of one core. cycles per run of each, overlap only */
+extern bool smt_corun(void (*a)(void), void (*b)(void), double *cycles_a, double *cycles_b);
 
+struct suite {
+    const char *name;
+    void (*run)(void);
+    bool exclusive;             /* LLC/DRAM bound, never runs next to other suites */
+};
 
+extern void run_parallel(const suite *suites, int num_suite, void (*worker_init)(void));
 
-extern char MIE_ALIGN(2048*1024) zero_mem[4096*1024];
-extern char MIE_ALIGN(2048*1024) data_mem[4096*1024];
+#define HYBRID_MAX_TYPE 4
+#define HYBRID_MAX_CPU 1024
 
-enum lt_op {
-    LT_LATENCY,
-    LT_THROUGHPUT,
-    LT_THROUGHPUT_KILLDEP
+struct core_type {
+    char name[32];              /* "cpu_core", "cpu_atom" */
+    int pmu_type;               /* perf pmu type for this core type, 0 : generic */
+    int num_cpu;
+    int cpus[HYBRID_MAX_CPU];
 };
 
-enum operand_type {
-    OT_INT,
-    OT_FP32,
-    OT_FP64
-};
+/* number of core types, 0 or 1 on non hybrid cpus. sysfs_root NULL : /sys */
+extern int hybrid_topology(const char *sysfs_root, core_type *types, int max);
 
-template <typename T> struct RegMap;
+extern const char *core_tag;    /* appended to class as "class@tag" on hybrid cpus, NULL otherwise */
 
-template <>
-struct RegMap<Xbyak::Xmm>
+static inline const char *
+tag_class(const char *class_name, char *buf, size_t len)
 {
-    const char *name;
-    Xbyak::Xmm v4, v5, v6, v7;
-    Xbyak::Xmm v8, v9, v10, v11, v12, v13, v14, v15;
+    if (core_tag == NULL) {
+        return class_name;
+    }
 
-    RegMap()
-        :name("m128"),
-         v4(4), v5(5), v6(6), v7(7),
-         v8(8), v9(9), v10(10), v11(11), v12(12), v13(13), v14(14), v15(15)
-        {}
+    snprintf(buf, len, "%s@%s", class_name, core_tag);
+    return buf;
+}
 
-    bool vec_reg() {
-        return true;
-    }
+/* host/cpu the results were measured on, see meta.cpp */
+struct run_meta {
+    char host[256];
+    char brand[64];
+    unsigned int signature;     /* cpuid 1 eax */
+    char microcode[32];         /* "" : unknown */
+    char kernel[128];
+    long long date;             /* unix time */
+};
 
-    void save(Xbyak::CodeGenerator *g, Xbyak::Xmm r, int off, enum operand_type ot) {
-        switch (ot) {
-        case OT_INT:
-            g->movdqa(g->ptr [g->rsp + off], r);
-            break;
-        case OT_FP32:
-            g->movaps(g->ptr [g->rsp + off], r);
-            break;
-        case OT_FP64:
-            g->movapd(g->ptr [g->rsp + off], r);
-            break;
-        }
-    }
+extern void run_meta_init(run_meta *m, const char *brand);
+extern bool run_meta_write(const char *path, const run_meta *m);
 
-    void restore(Xbyak::CodeGenerator *g, Xbyak::Xmm r, int off, enum operand_type ot) {
-        switch (ot) {
-        case OT_INT:
-            g->movdqa(r, g->ptr [g->rsp + off]);
-            break;
-        case OT_FP32:
-            g->movaps(r, g->ptr [g->rsp + off]);
-            break;
-        case OT_FP64:
-            g->movapd(r, g->ptr [g->rsp + off]);
-            break;
-        }
-    }
+/* cumulative RAPL energy in joules. NAN if the domain is not available */
+extern void read_energy(double *pkg, double *cores);
 
-    void killdep(Xbyak::CodeGenerator *g, Xbyak::Xmm r, enum operand_type ot) {
-        switch (ot) {
-        case OT_INT:
-            g->pxor(r, r);
-            break;
-        case OT_FP32:
-            g->xorps(r, r);
-            break;
-        case OT_FP64:
-            g->xorpd(r, r);
-            break;
-        }
-    }
+struct lt_result {
+    double cpi;
+    double ipc;
+    double upi;                 /* uops per instruction, -1 if uops_fd is not available */
+    enum ib_quality quality = IB_UNCHECKED;
+    bool cached = false;        /* taken from the result cache (--incremental) */
 };
 
-template <>
-struct RegMap<Xbyak::Ymm>
+extern const char *emit_header; /* --emit-header FILE, NULL : off */
+
+/* keeps latency/throughput rows of lt() for the cost table header */
+extern void costtable_add(const char *width, const char *inst, const char *on, const lt_result &r);
+extern bool costtable_write(const char *path, const char *brand);
+
+/* --snippet FILE : runs the blocks of FILE instead of the suites */
+extern bool run_snippet_file(const char *path);
+
+/*
+ * result cache of lt() rows, see cache.cpp. cache_find() only hits with
+ * --incremental, cache_store() always records for the next run.
+ */
+extern bool cache_active;       /* cache_open() was called */
+extern void cache_open(const char *path, const run_meta *m, bool incremental, long long ttl);
+extern bool cache_find(const char *class_name, const char *inst, const char *on,
+                       unsigned long long def, lt_result *r);
+extern void cache_store(const char *class_name, const char *inst, const char *on,
+                        unsigned long long def, const lt_result &r);
+extern bool cache_write(void);
+
+static inline void
+print_result(const char *class_name,
+             const char *name,
+             const char *on,
+             const lt_result &r)
 {
-    const char *name;
+    char tagged[128];
+    class_name = tag_class(class_name, tagged, sizeof(tagged));
 
-    Xbyak::Ymm v4, v5, v6, v7;
-    Xbyak::Ymm v8, v9, v10, v11, v12, v13, v14, v15;
+    const char *quality = ib_quality_name(r.quality);
+    const char *source = r.cached ? "cached" : "measured";
 
-    RegMap()
-        :name("m256"),
-         v4(4), v5(5), v6(6), v7(7),
-         v8(8), v9(9), v10(10), v11(11), v12(12), v13(13), v14(14), v15(15)
-        {}
+    fprintf(logs,
+            "\"%s\",\"%s\",\"%s\",\"%e\",\"%e\",\"%s\",\"%s\"\n",
+            class_name, name, on, r.cpi, r.ipc, quality, source);
 
-    bool vec_reg() {
-        return true;
+    if (output_csv) {
+        printf("\"%s\",\"%s\",\"%s\",\"%e\",\"%e\",\"%s\",\"%s\"\n",
+               class_name, name, on, r.cpi, r.ipc, quality, source);
+    } else if (r.cached) {
+        printf("%8s:%40s:%10s: CPI=%8.2f, IPC=%8.2f (cached)\n",
+               class_name, name, on, r.cpi, r.ipc);
+    } else if (r.quality == IB_RETRIED || r.quality == IB_DISTURBED) {
+        printf("%8s:%40s:%10s: CPI=%8.2f, IPC=%8.2f (%s)\n",
+               class_name, name, on, r.cpi, r.ipc, quality);
+    } else {
+        printf("%8s:%40s:%10s: CPI=%8.2f, IPC=%8.2f\n",
+               class_name, name, on, r.cpi, r.ipc);
     }
+}
 
-    void save(Xbyak::CodeGenerator *g, Xbyak::Ymm r, int off, enum operand_type ot) {
-        switch (ot) {
-        case OT_INT:
-            g->vmovdqa(g->ptr [g->rsp + off], r);
-            break;
-        case OT_FP32:
-            g->vmovaps(g->ptr [g->rsp + off], r);
-            break;
-        case OT_FP64:
-            g->vmovapd(g->ptr [g->rsp + off], r);
-            break;
-        }
-    }
+/* derived value (penalty, classification evidence, ...). stored in cpi column, ipc, quality and source are left empty */
+static inline void
+report_value(const char *class_name,
+             const char *name,
+             const char *metric,
+             double value)
+{
+    char tagged[128];
+    class_name = tag_class(class_name, tagged, sizeof(tagged));
 
-    void restore(Xbyak::CodeGenerator *g, Xbyak::Ymm r, int off, enum operand_type ot) {
-        switch (ot) {
-        case OT_INT:
-            g->vmovdqa(r, g->ptr [g->rsp + off]);
-            break;
-        case OT_FP32:
-            g->vmovaps(r, g->ptr [g->rsp + off]);
-            break;
-        case OT_FP64:
-            g->vmovapd(r, g->ptr [g->rsp + off]);
-            break;
-        }
-    }
+    fprintf(logs,
+            "\"%s\",\"%s\",\"%s\",\"%e\",\"\",\"\",\"\"\n",
+            class_name, name, metric, value);
 
-    void killdep(Xbyak::CodeGenerator *g, Xbyak::Ymm r, enum operand_type ot) {
-        switch (ot) {
-        case OT_INT:
-            g->vpxor(r, r, r);
-            break;
-        case OT_FP32:
-            g->vxorps(r, r, r);
-            break;
-        case OT_FP64:
-            g->vxorpd(r, r, r);
-            break;
-        }
+    if (output_csv) {
+        printf("\"%s\",\"%s\",\"%s\",\"%e\",\"\",\"\",\"\"\n",
+               class_name, name, metric, value);
+    } else {
+        printf("%8s:%40s:%10s: %8.2f\n",
+               class_name, name, metric, value);
     }
-};
+}
 
-template <>
-struct RegMap<Xbyak::Zmm>
+static inline ib_options
+lt_options(bool reserve_rcx,
+           int num_loop,
+           enum lt_op o,
+           enum operand_type ot)
 {
-    const char *name;
-    Xbyak::Zmm v4, v5, v6, v7;
-    Xbyak::Zmm v8, v9, v10, v11, v12, v13, v14, v15;
-    Xbyak::Zmm v16, v17, v18, v19, v20, v21, v22, v23;
-    Xbyak::Zmm v24, v25, v26, v27, v28, v29, v30, v31;
-
-    RegMap()
-        :name("m512"),
-         v4(4), v5(5), v6(6), v7(7),
-         v8(8), v9(9), v10(10), v11(11), v12(12), v13(13), v14(14), v15(15),
-         v16(16), v17(17), v18(18), v19(19), v20(20), v21(21), v22(22), v23(23),
-         v24(24), v25(25), v26(26), v27(27), v28(28), v29(29), v30(30), v31(31)
-        {}
-
-    bool vec_reg() {
-        return true;
+    ib_options opt;
+    opt.mode = o;
+    opt.ot = ot;
+    opt.num_loop = num_loop;
+    opt.reserve_rcx = reserve_rcx;
+    if (loop_align_offset < 0) {
+        opt.dump_path = dump_path;
     }
 
-    void save(Xbyak::CodeGenerator *g, Xbyak::Ymm r, int off, enum operand_type ot) {
-        switch (ot) {
-        case OT_INT:
-            g->vmovdqa(g->ptr [g->rsp + off], r);
-            break;
-        case OT_FP32:
-            g->vmovaps(g->ptr [g->rsp + off], r);
-            break;
-        case OT_FP64:
-            g->vmovapd(g->ptr [g->rsp + off], r);
-            break;
-        }
-    }
+    return opt;
+}
 
-    void restore(Xbyak::CodeGenerator *g, Xbyak::Ymm r, int off, enum operand_type ot) {
-        switch (ot) {
-        case OT_INT:
-            g->vmovdqa(r, g->ptr [g->rsp + off]);
-            break;
-        case OT_FP32:
-            g->vmovaps(r, g->ptr [g->rsp + off]);
-            break;
-        case OT_FP64:
-            g->vmovapd(r, g->ptr [g->rsp + off]);
-            break;
-        }
+template <typename RegType, typename F>
+lt_result
+lt_exec(F f,
+        bool reserve_rcx,
+        int num_loop,
+        enum lt_op o,
+        enum operand_type ot)
+{
+    ib_result ir = ib_measure<RegType>(f, lt_options(reserve_rcx, num_loop, o, ot));
+    if (!ir.ok) {
+        perror("read");
+        exit(1);
     }
 
-    void killdep(Xbyak::CodeGenerator *g, Xbyak::Ymm r, enum operand_type ot) {
-        switch (ot) {
-        case OT_INT:
-            g->vpxorq(r, r, r);
-            break;
-        case OT_FP32:
-            g->vpxorq(r, r, r);
-            break;
-        case OT_FP64:
-            g->vpxorq(r, r, r);
-            break;
-        }
-    }
-};
+    lt_result r;
+    r.cpi = ir.cpi;
+    r.ipc = ir.ipc;
+    r.upi = ir.upi;
+    r.quality = ir.quality;
 
+    return r;
+}
 
+/* (max-min)/min of cpi over loop placements above this is reported as sensitive */
+#define ALIGN_SENSITIVE 0.1
 
-template <>
-struct RegMap<Xbyak::Reg64>
+/*
+ * re-JIT with the loop start at every offset 0..63 in a 64byte line.
+ * catches DSB (32/64byte window) and JCC erratum (jcc crossing or ending
+ * on a 32byte boundary) effects that a single align(16) placement hides.
+ */
+template <typename RegType, typename F>
+void
+lt_align_sweep(const char *name,
+               const char *on,
+               F f,
+               bool reserve_rcx,
+               int num_loop,
+               enum lt_op o,
+               enum operand_type ot)
 {
-    const char *name;
-    Xbyak::Reg64 v4, v5, v6, v7;
-    Xbyak::Reg64 v8, v9, v10, v11, v12, v13, v14, v15;
-
-    RegMap()
-        :name("reg64"),
-         v4(Xbyak::Operand::RSP),
-         v5(Xbyak::Operand::RBP),
-         v6(Xbyak::Operand::RSI),
-         v7(Xbyak::Operand::RDI),
-         v8(Xbyak::Operand::R8),
-         v9(Xbyak::Operand::R9),
-         v10(Xbyak::Operand::R10),
-         v11(Xbyak::Operand::R11),
-         v12(Xbyak::Operand::R12),
-         v13(Xbyak::Operand::R13),
-         v14(Xbyak::Operand::R14),
-         v15(Xbyak::Operand::R15)
-        {}
-
-    bool vec_reg() {
-        return false;
-    }
+    const char *class_name = RegMap<RegType>().name;
+    double min = 0, max = 0;
+    int worst = 0;
+    char metric[64];
 
-    void save(Xbyak::CodeGenerator *g, Xbyak::Reg64 r, int off, enum operand_type ) {
-        g->mov(g->ptr[g->rsp + off], r);
-    }
+    for (int off=0; off<64; off++) {
+        loop_align_offset = off;
+        lt_result r = lt_exec<RegType>(f, reserve_rcx, num_loop, o, ot);
 
-    void restore(Xbyak::CodeGenerator *g, Xbyak::Reg64 r, int off, enum operand_type ) {
-        g->mov(r, g->ptr[g->rsp + off]);
+        if (off == 0 || r.cpi < min) {
+            min = r.cpi;
+        }
+        if (off == 0 || r.cpi > max) {
+            max = r.cpi;
+            worst = off;
+        }
     }
+    loop_align_offset = -1;
 
-    void killdep(Xbyak::CodeGenerator *g, Xbyak::Reg64 r, enum operand_type) {
-        g->xor_(r, r);
-    }
+    double spread = (max - min) / min;
 
-};
+    snprintf(metric, sizeof(metric), "%s align min", on);
+    report_value(class_name, name, metric, min);
+    snprintf(metric, sizeof(metric), "%s align max", on);
+    report_value(class_name, name, metric, max);
+    snprintf(metric, sizeof(metric), "%s align spread", on);
+    report_value(class_name, name, metric, spread);
 
-template <typename RegType, typename Gen, typename F>
-struct gen_throughput{
-    void operator () (Gen *g, RegMap<RegType> &rm, F f, int num_insn){
-        if (rm.vec_reg()) {
-            for (int ii=0; ii<num_insn/12; ii++) {
-                f(g, rm.v4, rm.v4);
-                f(g, rm.v5, rm.v5);
-                f(g, rm.v6, rm.v6);
-                f(g, rm.v7, rm.v7);
-                f(g, rm.v8, rm.v8);
-                f(g, rm.v9, rm.v9);
-                f(g, rm.v10, rm.v10);
-                f(g, rm.v11, rm.v11);
-                f(g, rm.v12, rm.v12);
-                f(g, rm.v13, rm.v13);
-                f(g, rm.v14, rm.v14);
-                f(g, rm.v15, rm.v15);
-            }
-        } else {
-            for (int ii=0; ii<num_insn/8; ii++) {
-                f(g, rm.v8, rm.v8);
-                f(g, rm.v9, rm.v9);
-                f(g, rm.v10, rm.v10);
-                f(g, rm.v11, rm.v11);
-                f(g, rm.v12, rm.v12);
-                f(g, rm.v13, rm.v13);
-                f(g, rm.v14, rm.v14);
-                f(g, rm.v15, rm.v15);
-            }
-        }
+    if (spread > ALIGN_SENSITIVE) {
+        snprintf(metric, sizeof(metric), "%s align worst", on);
+        report_value(class_name, name, metric, worst);
     }
-};
+}
 
+/* throughput kernels are repeated for at least this long, RAPL updates every ~1ms */
+#define ENERGY_MIN_CYCLES (512LL*1024*1024)
 
-template <typename RegType,
-          typename F>
-struct Gen
-    :public Xbyak::CodeGenerator
+template <typename RegType, typename F>
+void
+lt_energy(const char *name,
+          F f,
+          bool reserve_rcx,
+          int num_loop,
+          enum lt_op o,
+          enum operand_type ot)
 {
-    Gen(F f, bool reserve_rcx, int num_loop, int num_insn, enum lt_op o, enum operand_type ot) {
-        RegMap<RegType> rm;
+    const char *class_name = RegMap<RegType>().name;
+    double pkg0, cores0, pkg1, cores1;
+
+    read_energy(&pkg0, &cores0);
+    if (isnan(pkg0) && isnan(cores0)) {
+        report_value(class_name, name, "nJ/inst pkg", NAN);
+        report_value(class_name, name, "nJ/inst cores", NAN);
+        report_value(class_name, name, "watts pkg", NAN);
+        return;
+    }
 
-        int reg_size = 64;
-        int num_reg = 12;
+    int num_insn = get_num_insn<RegType>();
 
-        push(rbp);
-        mov(rbp, rsp);
-        and_(rsp, -(Xbyak::sint64)64);
-        sub(rsp, reg_size * (num_reg + 1));
-
-        if (rm.vec_reg()) {
-            rm.save(this, rm.v4,  -reg_size*12, ot);
-            rm.save(this, rm.v5,  -reg_size*11, ot);
-            rm.save(this, rm.v6,  -reg_size*10, ot);
-            rm.save(this, rm.v7,  -reg_size*9, ot);
-        }
+    Gen<RegType,F> g(f, reserve_rcx, num_loop, num_insn, o, ot);
+    typedef void (*func_t)(void);
+    func_t exec = (func_t)g.getCode();
 
-        rm.save(this, rm.v8,  -reg_size*8, ot);
-        rm.save(this, rm.v9,  -reg_size*7, ot);
-        rm.save(this, rm.v10, -reg_size*6, ot);
-        rm.save(this, rm.v11, -reg_size*5, ot);
-        rm.save(this, rm.v12, -reg_size*4, ot);
-        rm.save(this, rm.v13, -reg_size*3, ot);
-        rm.save(this, rm.v14, -reg_size*2, ot);
-        rm.save(this, rm.v15, -reg_size*1, ot);
-
-        if (rm.vec_reg()) {
-            rm.killdep(this, rm.v4, ot);
-            rm.killdep(this, rm.v5, ot);
-            rm.killdep(this, rm.v6, ot);
-            rm.killdep(this, rm.v7, ot);
-        }
+    memset(zero_mem, 0, sizeof(zero_mem));
+    memset(data_mem, ~0, sizeof(data_mem));
+    exec();
 
-        rm.killdep(this, rm.v8, ot);
-        rm.killdep(this, rm.v9, ot);
-        rm.killdep(this, rm.v10, ot);
-        rm.killdep(this, rm.v11, ot);
-        rm.killdep(this, rm.v12, ot);
-        rm.killdep(this, rm.v13, ot);
-        rm.killdep(this, rm.v14, ot);
-        rm.killdep(this, rm.v15, ot);
-
-        Xbyak::Reg64 counter_reg = rcx;
-        if (reserve_rcx) {
-            counter_reg = rdx;
-            mov(rcx, 16);
-            mov(rax, 16);
-        } else {
-            mov(rdx, (intptr_t)zero_mem);
-        }
+    long long n = 0;
+    std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+    read_energy(&pkg0, &cores0);
+    long long b = read_cycle_or_exit();
 
-        mov(counter_reg, num_loop);
-        mov(ptr[rsp], rdi);
-        xor_(rdi, rdi);
+    do {
+        exec();
+        n++;
+    } while (read_cycle_or_exit() - b < ENERGY_MIN_CYCLES);
 
-        align(16);
-        L("@@");
+    read_energy(&pkg1, &cores1);
+    std::chrono::steady_clock::time_point t1 = std::chrono::steady_clock::now();
 
-        switch (o) {
-        case LT_LATENCY:
-            for (int ii=0; ii<num_insn; ii++) {
-                f(this, rm.v8, rm.v8);
-            }
-            break;
-
-        case LT_THROUGHPUT:
-            gen_throughput<RegType,Gen,F>()(this, rm, f, num_insn);
-            break;
-
-        case LT_THROUGHPUT_KILLDEP:
-            if (rm.vec_reg()) {
-                for (int ii=0; ii<num_insn/12; ii++) {
-                    f(this, rm.v4, rm.v4);
-                    f(this, rm.v5, rm.v5);
-                    f(this, rm.v6, rm.v6);
-                    f(this, rm.v7, rm.v7);
-                    f(this, rm.v8, rm.v8);
-                    f(this, rm.v9, rm.v9);
-                    f(this, rm.v10, rm.v10);
-                    f(this, rm.v11, rm.v11);
-                    f(this, rm.v12, rm.v12);
-                    f(this, rm.v13, rm.v13);
-                    f(this, rm.v14, rm.v14);
-                    f(this, rm.v15, rm.v15);
-                }
-
-                rm.killdep(this, rm.v4, ot);
-                rm.killdep(this, rm.v5, ot);
-                rm.killdep(this, rm.v6, ot);
-                rm.killdep(this, rm.v7, ot);
-                rm.killdep(this, rm.v8, ot);
-                rm.killdep(this, rm.v9, ot);
-                rm.killdep(this, rm.v10, ot);
-                rm.killdep(this, rm.v11, ot);
-                rm.killdep(this, rm.v12, ot);
-                rm.killdep(this, rm.v13, ot);
-                rm.killdep(this, rm.v14, ot);
-                rm.killdep(this, rm.v15, ot);
-            } else {
-                for (int ii=0; ii<num_insn/8; ii++) {
-                    f(this, rm.v8, rm.v8);
-                    f(this, rm.v9, rm.v9);
-                    f(this, rm.v10, rm.v10);
-                    f(this, rm.v11, rm.v11);
-                    f(this, rm.v12, rm.v12);
-                    f(this, rm.v13, rm.v13);
-                    f(this, rm.v14, rm.v14);
-                    f(this, rm.v15, rm.v15);
-                }
-
-                rm.killdep(this, rm.v8, ot);
-                rm.killdep(this, rm.v9, ot);
-                rm.killdep(this, rm.v10, ot);
-                rm.killdep(this, rm.v11, ot);
-                rm.killdep(this, rm.v12, ot);
-                rm.killdep(this, rm.v13, ot);
-                rm.killdep(this, rm.v14, ot);
-                rm.killdep(this, rm.v15, ot);
-                
-            }
-            break;
-        }
+    double sec = std::chrono::duration<double>(t1 - t0).count();
+    double insts = (double)n * num_insn * num_loop;
 
-        dec(counter_reg);
-        jnz("@b");
+    /* sysfs counters wrap around, drop the sample */
+    double pkg = pkg1 - pkg0;
+    double cores = cores1 - cores0;
+    if (pkg < 0) {
+        pkg = NAN;
+    }
+    if (cores < 0) {
+        cores = NAN;
+    }
 
-        mov(rdi, ptr[rsp]);
-        if (rm.vec_reg()) {
-            rm.restore(this, rm.v4,  -reg_size*12, ot);
-            rm.restore(this, rm.v5,  -reg_size*11, ot);
-            rm.restore(this, rm.v6, -reg_size*10, ot);
-            rm.restore(this, rm.v7, -reg_size*9, ot);
-        }
+    report_value(class_name, name, "nJ/inst pkg", pkg * 1e9 / insts);
+    report_value(class_name, name, "nJ/inst cores", cores * 1e9 / insts);
+    report_value(class_name, name, "watts pkg", pkg / sec);
+}
 
-        rm.restore(this, rm.v8,  -reg_size*8, ot);
-        rm.restore(this, rm.v9,  -reg_size*7, ot);
-        rm.restore(this, rm.v10, -reg_size*6, ot);
-        rm.restore(this, rm.v11, -reg_size*5, ot);
-        rm.restore(this, rm.v12, -reg_size*4, ot);
-        rm.restore(this, rm.v13, -reg_size*3, ot);
-        rm.restore(this, rm.v14, -reg_size*2, ot);
-        rm.restore(this, rm.v15, -reg_size*1, ot);
+template <typename RegType, typename F>
+void
+lt_smt(const char *name,
+       F f,
+       bool reserve_rcx,
+       int num_loop,
+       enum lt_op o,
+       enum operand_type ot,
+       const lt_result &solo)
+{
+    const char *class_name = RegMap<RegType>().name;
+    int num_insn = get_num_insn<RegType>();
 
-        mov(rsp, rbp);
-        pop(rbp);
-        ret();
-            
-        /*
-         * latency:
-         *
-         *       mov rcx, count
-         * loop:
-         *       op reg, reg
-         *       op reg, reg
-         *       ...
-         *       op reg, reg
-         *       dec rcx
-         *       jne loop
-         *
-         */
-
-        /*
-         * throughput
-         *
-         *       mov rcx, count
-         * loop:
-         *       op reg8, reg8
-         *       op reg9, reg9
-         *       ...
-         *       op reg15, reg15
-         *       op reg8, reg8
-         *       op reg9, reg9
-         *       ...
-         *       op reg15, reg15
-         *       ...
-         *       if kill_dep {
-         *       xor r8
-         *       xor r9
-         *       ...
-         *       xor r15
-         *       }
-         *       dec rcx
-         *       jne loop
-         *
-         */
-        
-    }
-};
-    
+    Gen<RegType,F> g(f, reserve_rcx, num_loop, num_insn, o, ot);
+    typedef void (*func_t)(void);
+    func_t exec = (func_t)g.getCode();
 
-template <typename RegType> int get_num_insn(void) {
-    RegMap<RegType> rm;
-    if (rm.vec_reg()) {
-        return 36;
-    } else {
-        return 64;
+    double c0, c1;
+    if (!smt_corun(exec, exec, &c0, &c1)) {
+        return;
     }
- }
+
+    double n = num_insn * (double)num_loop;
+    double ipc0 = n / c0, ipc1 = n / c1;
+
+    report_value(class_name, name, "smt ipc t0", ipc0);
+    report_value(class_name, name, "smt ipc t1", ipc1);
+    report_value(class_name, name, "smt ipc total", ipc0 + ipc1);
+    report_value(class_name, name, "smt scaling", (ipc0 + ipc1) / solo.ipc);
+}
 
 template <typename RegType, typename F>
-void
+lt_result
 lt(const char *name,
    const char *on,
    F f,
@@ -548,54 +361,42 @@ lt(const char *name,
    enum lt_op o,
    enum operand_type ot)
 {
-    int num_insn = get_num_insn<RegType>();
+    char tagged[128];
+    const char *class_name = tag_class(RegMap<RegType>().name, tagged, sizeof(tagged));
+    lt_result r;
 
-    Gen<RegType,F> g(f, reserve_rcx, num_loop, num_insn, o, ot);
-    typedef void (*func_t)(void);
-    func_t exec = (func_t)g.getCode();
+    if (cache_active) {
+        unsigned long long def = ib_definition_hash<RegType>(f, lt_options(reserve_rcx, num_loop, o, ot));
 
-    if (1) {
-        char *p = (char*)g.getCode();
-        int sz = g.getSize();
-        FILE *fp = fopen("out.bin", "wb");
-        for (int i=0; i<sz; i++) {
-            fputc(p[i], fp);
+        if (!cache_find(class_name, name, on, def, &r)) {
+            r = lt_exec<RegType>(f, reserve_rcx, num_loop, o, ot);
+            cache_store(class_name, name, on, def, r);
         }
-        fclose(fp);
+    } else {
+        r = lt_exec<RegType>(f, reserve_rcx, num_loop, o, ot);
     }
 
-    memset(zero_mem, 0, sizeof(zero_mem));
-    memset(data_mem, ~0, sizeof(data_mem));
-    exec();
+    print_result(RegMap<RegType>().name, name, on, r);
 
-    long long b = read_cycle();
-    exec();
-    long long e = read_cycle();
+    if (emit_header) {
+        costtable_add(class_name, name, on, r);
+    }
 
-    fprintf(logs,
-            "\"%s\",\"%s\",\"%s\",\"%e\",\"%e\"\n",
-            RegMap<RegType>().name,
-            name, on,
-            (e-b)/(double)(num_insn * num_loop), 
-            (num_insn * num_loop)/(double)(e-b));
+    if (align_sweep) {
+        lt_align_sweep<RegType>(name, on, f, reserve_rcx, num_loop, o, ot);
+    }
 
-    if (output_csv) {
-        printf("\"%s\",\"%s\",\"%s\",\"%e\",\"%e\"\n",
-               RegMap<RegType>().name,
-               name, on,
-               (e-b)/(double)(num_insn * num_loop), 
-               (num_insn * num_loop)/(double)(e-b));
-    } else {
-        printf("%8s:%40s:%10s: CPI=%8.2f, IPC=%8.2f\n",
-               RegMap<RegType>().name,
-               name, on,
-               (e-b)/(double)(num_insn * num_loop), 
-               (num_insn * num_loop)/(double)(e-b));
+    if (energy_mode && o != LT_LATENCY) {
+        lt_energy<RegType>(name, f, reserve_rcx, num_loop, o, ot);
     }
 
-}           
+    if (smt_mode && o != LT_LATENCY) {
+        lt_smt<RegType>(name, f, reserve_rcx, num_loop, o, ot, r);
+    }
+
+    return r;
+}
 
-#define NUM_LOOP (16384*8)
 
 template <typename RegType, typename F>
 void
@@ -678,6 +479,124 @@ run_throghput_only(const char *name, F_t f_t,bool kill_dep, bool reserve_rcx, en
     name,                                                               \
     [](Xbyak::CodeGenerator *g, Xbyak::rt dst, Xbyak::rt src){expr_t;}, \
     kd, true, ot);
+
+/* single measurement, returns lt_result (for suites that derive values from several runs) */
+#define GEN_lt(rt, name, on, expr, o, ot)                               \
+    lt<Xbyak::rt>(                                                      \
+    name, on,                                                           \
+    [](Xbyak::CodeGenerator *g, Xbyak::rt dst, Xbyak::rt src){expr;},   \
+    false, NUM_LOOP, o, ot)
+
+
+/*
+ * pointer chase over memory prepared by caller
+ *
+ *       (chain regs) = heads[0..num_chain-1]
+ * loop:
+ *       mov c0, [c0]
+ *       filler
+ *       mov c1, [c1]
+ *       filler
+ *       ...                   (num_chain * unroll loads)
+ *       dec rcx
+ *       jnz loop
+ *
+ * chain i uses chase_reg(i). registers after the last chain register are
+ * free for the filler, and rdi points to zero_mem. filler code must fit in
+ * CHASE_FILLER_BYTES per chain step.
+ * final pointers are written back to heads[].
+ */
+
+#define CHASE_MAX_CHAIN 12
+#define CHASE_FILLER_BYTES 8192
+
+static inline Xbyak::Reg64
+chase_reg(int i)
+{
+    static const int idx[CHASE_MAX_CHAIN] = {
+        Xbyak::Operand::RAX, Xbyak::Operand::RBX, Xbyak::Operand::RSI, Xbyak::Operand::RDX,
+        Xbyak::Operand::R8, Xbyak::Operand::R9, Xbyak::Operand::R10, Xbyak::Operand::R11,
+        Xbyak::Operand::R12, Xbyak::Operand::R13, Xbyak::Operand::R14, Xbyak::Operand::R15,
+    };
+    return Xbyak::Reg64(idx[i]);
+}
+
+struct chase_no_filler {
+    void operator()(Xbyak::CodeGenerator *) {}
+};
+
+template <typename F>
+struct Chase
+    :public Xbyak::CodeGenerator
+{
+    Chase(F filler, int num_chain, int num_loop, int unroll)
+        :Xbyak::CodeGenerator(4096 + num_chain * unroll * (16 + CHASE_FILLER_BYTES))
+    {
+        push(rbx);
+        push(rbp);
+        push(r12);
+        push(r13);
+        push(r14);
+        push(r15);
+
+        mov(rbp, rdi);
+        for (int ci=0; ci<num_chain; ci++) {
+            mov(chase_reg(ci), ptr[rbp + ci*8]);
+        }
+
+        mov(rdi, (intptr_t)zero_mem);
+        mov(rcx, num_loop);
+
+        align(16);
+        L("@@");
+
+        for (int ui=0; ui<unroll; ui++) {
+            for (int ci=0; ci<num_chain; ci++) {
+                mov(chase_reg(ci), ptr[chase_reg(ci)]);
+                filler(this);
+            }
+        }
+
+        dec(rcx);
+        jnz("@b");
+
+        for (int ci=0; ci<num_chain; ci++) {
+            mov(ptr[rbp + ci*8], chase_reg(ci));
+        }
+
+        pop(r15);
+        pop(r14);
+        pop(r13);
+        pop(r12);
+        pop(rbp);
+        pop(rbx);
+        ret();
+    }
+};
+
+/* returns cycles per loop iteration / unroll, ie. cycles per step of all chains */
+template <typename F>
+double
+chase(void **heads, int num_chain, int num_loop, int unroll, F filler)
+{
+    Chase<F> g(filler, num_chain, num_loop, unroll);
+    typedef void (*func_t)(void **heads);
+    func_t exec = (func_t)g.getCode();
+
+    exec(heads);
+
+    long long b = read_cycle_or_exit();
+    exec(heads);
+    long long e = read_cycle_or_exit();
+
+    return (e-b) / (double)(num_loop * (long long)unroll);
+}
+
+static inline double
+chase(void **heads, int num_chain, int num_loop, int unroll)
+{
+    return chase(heads, num_chain, num_loop, unroll, chase_no_filler());
+}
         
 
 extern void test_generic();
@@ -685,5 +604,19 @@ extern void test_mpx();
 extern void test_avx512();
 extern void test_avx();
 extern void test_sse();
+extern void test_fence();
+extern void test_rename();
+extern void test_partial();
+extern void test_fusion();
+extern void test_bypass();
+extern void test_memport();
+extern void test_tlb();
+extern void test_mlp();
+extern void test_rob();
+extern void test_bmi();
+extern void test_conv();
+extern void test_strops();
+extern void test_smt();
+extern void test_transition();
 
 #endif
\ No newline at end of file
@@ -9,9 +9,11 @@ class Result:
     def __init__(self):
         self.latency = {}
         self.throughput = {}
+        # derived values (penalty, idiom classification, ...) : metric -> {(class,inst) : row}
+        self.values = {}
 
 
-def load_csv(path, l_inst, t_inst):
+def load_csv(path, l_inst, t_inst, v_inst):
     import csv
 
     result = Result()
@@ -27,12 +29,26 @@ def load_csv(path, l_inst, t_inst):
             if lt == 'latency':
                 result.latency[(clas,inst)] = row
                 l_inst[(clas,inst)] = True
-            else:
+            elif lt == 'throughput':
                 result.throughput[(clas,inst)] = row
                 t_inst[(clas,inst)] = True
+            else:
+                result.values.setdefault(lt, {})[(clas,inst)] = row
+                v_inst[(clas,inst,lt)] = True
 
     return result
 
+def dump_value(l_row, r_row, clas, inst, metric):
+    l_val = 'N/A'
+    r_val = 'N/A'
+    if l_row:
+        l_val = "%.2f"%(float(l_row['cpi']))
+    if r_row:
+        r_val = "%.2f"%(float(r_row['cpi']))
+
+    print("%8s %32s | %-14s %7s-%-7s"%
+          (clas, inst, metric, l_val, r_val))
+
 def dump_row(l_row, r_row, clas, inst):
     ratio = 'N/A'
     l_val = 'N/A'
@@ -95,9 +111,10 @@ def main():
 
     l_list = {}
     t_list = {}
+    v_list = {}
 
-    l = load_csv(left, l_list, t_list)
-    r = load_csv(right, l_list, t_list)
+    l = load_csv(left, l_list, t_list, v_list)
+    r = load_csv(right, l_list, t_list, v_list)
 
     print("============= LATENCY ==============================================================================")
     print("%8s %32s | %7s%8s (%6s[%%]), %7s%8s (%6s[%%])"%
@@ -151,7 +168,22 @@ def main():
 
         dump_row(l_row, r_row, i[0], i[1])
 
-    
+    v_list = list(v_list.keys())
+    v_list.sort()
+
+    if v_list:
+        print("\n")
+        print("============= DERIVED ==============================================================================")
+        print("%8s %32s | %-14s %7s-%-7s"%
+              (' ', 'instruction', 'metric', 'left', 'right'))
+        print("------------------------------------------+---------------------------------------------------------")
+
+        for i in v_list:
+            l_row = l.values.get(i[2], {}).get((i[0],i[1]))
+            r_row = r.values.get(i[2], {}).get((i[0],i[1]))
+
+            dump_value(l_row, r_row, i[0], i[1], i[2])
+
 
 if __name__ == '__main__':
     main()
\ No newline at end of file
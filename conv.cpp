@@ -0,0 +1,188 @@
+#include "common.hpp"
+
+/*
+ * conversions, pack/unpack and scalar<->vector moves
+ *
+ * instructions crossing between gpr and vector registers can't form a
+ * chain on their own, so their latency is measured as a round trip
+ * ("a->b") through rax, the same way as "movq->movq" in sse.cpp.
+ * all data is zero, so int->fp->int round trips keep rax at zero.
+ */
+
+static inline Xbyak::Xmm
+x(const Xbyak::Xmm &r)
+{
+    return Xbyak::Xmm(r.getIdx());
+}
+
+static inline Xbyak::Ymm
+y(const Xbyak::Xmm &r)
+{
+    return Xbyak::Ymm(r.getIdx());
+}
+
+static void
+test_conv_sse()
+{
+    /* int <-> fp, packed */
+    GEN(Xmm, "cvtdq2ps", (g->cvtdq2ps(dst, src)), false, OT_FP32);
+    GEN(Xmm, "cvttps2dq", (g->cvttps2dq(dst, src)), false, OT_FP32);
+    GEN(Xmm, "cvtdq2pd", (g->cvtdq2pd(dst, src)), false, OT_FP64);
+    GEN(Xmm, "cvtpd2dq", (g->cvtpd2dq(dst, src)), false, OT_FP64);
+    GEN(Xmm, "cvttpd2dq", (g->cvttpd2dq(dst, src)), false, OT_FP64);
+
+    /* fp32 <-> fp64 */
+    GEN(Xmm, "cvtps2pd", (g->cvtps2pd(dst, src)), false, OT_FP32);
+    GEN(Xmm, "cvtpd2ps", (g->cvtpd2ps(dst, src)), false, OT_FP64);
+    GEN(Xmm, "cvtss2sd", (g->cvtss2sd(dst, src)), false, OT_FP32);
+    GEN(Xmm, "cvtsd2ss", (g->cvtsd2ss(dst, src)), false, OT_FP64);
+
+    /* int <-> fp, scalar gpr */
+    GEN_throughput_only(Xmm, "cvtsi2sd r64", (g->cvtsi2sd(dst, g->rax)), false, OT_FP64);
+    GEN_throughput_only(Xmm, "cvtsi2sd r32", (g->cvtsi2sd(dst, g->eax)), false, OT_FP64);
+    GEN_throughput_only(Xmm, "cvtsi2ss r64", (g->cvtsi2ss(dst, g->rax)), false, OT_FP32);
+    GEN_throughput_only(Xmm, "cvttsd2si r64", (g->cvttsd2si(g->rax, src)), false, OT_FP64);
+    GEN_throughput_only(Xmm, "cvttsd2si r32", (g->cvttsd2si(g->eax, src)), false, OT_FP64);
+    GEN_throughput_only(Xmm, "cvttss2si r64", (g->cvttss2si(g->rax, src)), false, OT_FP32);
+
+    GEN_latency_only(Xmm, "cvttsd2si->cvtsi2sd r64",
+                     (g->cvttsd2si(g->rax, src));(g->cvtsi2sd(dst, g->rax)),
+                     false, OT_FP64);
+    GEN_latency_only(Xmm, "cvttsd2si->cvtsi2sd r32",
+                     (g->cvttsd2si(g->eax, src));(g->cvtsi2sd(dst, g->eax)),
+                     false, OT_FP64);
+    GEN_latency_only(Xmm, "cvttss2si->cvtsi2ss r64",
+                     (g->cvttss2si(g->rax, src));(g->cvtsi2ss(dst, g->rax)),
+                     false, OT_FP32);
+
+    /* pack/unpack with saturation */
+    GEN(Xmm, "packssdw", (g->packssdw(dst, src)), false, OT_INT);
+    GEN(Xmm, "packsswb", (g->packsswb(dst, src)), false, OT_INT);
+    GEN(Xmm, "packuswb", (g->packuswb(dst, src)), false, OT_INT);
+    GEN(Xmm, "punpcklbw", (g->punpcklbw(dst, src)), false, OT_INT);
+    GEN(Xmm, "punpckhbw", (g->punpckhbw(dst, src)), false, OT_INT);
+    GEN(Xmm, "punpckldq", (g->punpckldq(dst, src)), false, OT_INT);
+    GEN(Xmm, "punpcklqdq", (g->punpcklqdq(dst, src)), false, OT_INT);
+
+    /* scalar <-> vector */
+    GEN_throughput_only(Xmm, "movd xmm,r32", (g->movd(dst, g->eax)), false, OT_INT);
+    GEN_throughput_only(Xmm, "movd r32,xmm", (g->movd(g->eax, src)), false, OT_INT);
+    GEN_latency_only(Xmm, "movd->movd",
+                     (g->movd(g->eax, src));(g->movd(dst, g->eax)),
+                     false, OT_INT);
+    GEN_latency_only(Xmm, "pextrw->pinsrw",
+                     (g->pextrw(g->eax, src, 0));(g->pinsrw(dst, g->eax, 0)),
+                     false, OT_INT);
+
+    if (info.have_sse41) {
+        GEN(Xmm, "packusdw", (g->packusdw(dst, src)), false, OT_INT);
+        GEN(Xmm, "pmovzxbw", (g->pmovzxbw(dst, src)), false, OT_INT);
+        GEN(Xmm, "pmovzxbd", (g->pmovzxbd(dst, src)), false, OT_INT);
+        GEN(Xmm, "pmovzxdq", (g->pmovzxdq(dst, src)), false, OT_INT);
+        GEN(Xmm, "pmovsxbw", (g->pmovsxbw(dst, src)), false, OT_INT);
+        GEN(Xmm, "pmovsxwd", (g->pmovsxwd(dst, src)), false, OT_INT);
+
+        GEN_throughput_only(Xmm, "pextrq", (g->pextrq(g->rax, src, 1)), false, OT_INT);
+        GEN_throughput_only(Xmm, "pinsrq", (g->pinsrq(dst, g->rax, 1)), false, OT_INT);
+        GEN_latency_only(Xmm, "pextrq->pinsrq",
+                         (g->pextrq(g->rax, src, 1));(g->pinsrq(dst, g->rax, 1)),
+                         false, OT_INT);
+    }
+}
+
+static void
+test_conv_avx()
+{
+    if (info.have_avx) {
+        GEN(Ymm, "vcvtdq2ps", (g->vcvtdq2ps(dst, src)), false, OT_FP32);
+        GEN(Ymm, "vcvtps2dq", (g->vcvtps2dq(dst, src)), false, OT_FP32);
+        GEN(Ymm, "vcvttps2dq", (g->vcvttps2dq(dst, src)), false, OT_FP32);
+        GEN(Ymm, "vcvtdq2pd", (g->vcvtdq2pd(dst, x(src))), false, OT_FP64);
+        GEN(Ymm, "vcvtps2pd", (g->vcvtps2pd(dst, x(src))), false, OT_FP32);
+        GEN(Ymm, "vcvtpd2ps", (g->vcvtpd2ps(x(dst), src)), false, OT_FP64);
+
+        GEN(Ymm, "vinsertf128", (g->vinsertf128(dst, dst, x(src), 1)), false, OT_FP32);
+        GEN(Ymm, "vextractf128", (g->vextractf128(x(dst), src, 1)), false, OT_FP32);
+
+        GEN_latency_only(Xmm, "vpextrq->vpinsrq",
+                         (g->vpextrq(g->rax, src, 1));(g->vpinsrq(dst, dst, g->rax, 1)),
+                         false, OT_INT);
+    }
+
+    if (info.have_f16c) {
+        GEN(Xmm, "vcvtph2ps", (g->vcvtph2ps(dst, src)), false, OT_FP32);
+        GEN(Xmm, "vcvtps2ph", (g->vcvtps2ph(dst, src, 0)), false, OT_FP32);
+        GEN(Ymm, "vcvtph2ps", (g->vcvtph2ps(dst, x(src))), false, OT_FP32);
+        GEN(Ymm, "vcvtps2ph", (g->vcvtps2ph(x(dst), src, 0)), false, OT_FP32);
+        GEN_latency_only(Ymm, "vcvtps2ph->vcvtph2ps",
+                         (g->vcvtps2ph(x(dst), src, 0));(g->vcvtph2ps(dst, x(dst))),
+                         false, OT_FP32);
+    }
+
+    if (info.have_avx2) {
+        GEN(Ymm, "vpackssdw", (g->vpackssdw(dst, dst, src)), false, OT_INT);
+        GEN(Ymm, "vpackuswb", (g->vpackuswb(dst, dst, src)), false, OT_INT);
+        GEN(Ymm, "vpunpcklbw", (g->vpunpcklbw(dst, dst, src)), false, OT_INT);
+        GEN(Ymm, "vpmovzxbw", (g->vpmovzxbw(dst, x(src))), false, OT_INT);
+        GEN(Ymm, "vpmovzxbd", (g->vpmovzxbd(dst, x(src))), false, OT_INT);
+        GEN(Ymm, "vpmovzxdq", (g->vpmovzxdq(dst, x(src))), false, OT_INT);
+        GEN(Ymm, "vpmovsxbw", (g->vpmovsxbw(dst, x(src))), false, OT_INT);
+
+        GEN(Ymm, "vpbroadcastb", (g->vpbroadcastb(dst, x(src))), false, OT_INT);
+        GEN(Ymm, "vpbroadcastd", (g->vpbroadcastd(dst, x(src))), false, OT_INT);
+        GEN(Ymm, "vpbroadcastq", (g->vpbroadcastq(dst, x(src))), false, OT_INT);
+        GEN_latency_only(Ymm, "vmovd->vmovd->vpbroadcastd",
+                         (g->vmovd(g->eax, x(src)));(g->vmovd(x(dst), g->eax));(g->vpbroadcastd(dst, x(dst))),
+                         false, OT_INT);
+
+        GEN(Ymm, "vinserti128", (g->vinserti128(dst, dst, x(src), 1)), false, OT_INT);
+        GEN(Ymm, "vextracti128", (g->vextracti128(x(dst), src, 1)), false, OT_INT);
+    }
+}
+
+static void
+test_conv_avx512()
+{
+    if (!info.have_avx512f) {
+        return;
+    }
+
+    GEN(Zmm, "vcvtdq2ps", (g->vcvtdq2ps(dst, src)), false, OT_FP32);
+    GEN(Zmm, "vcvtps2dq", (g->vcvtps2dq(dst, src)), false, OT_FP32);
+    GEN(Zmm, "vcvttps2dq", (g->vcvttps2dq(dst, src)), false, OT_FP32);
+    GEN(Zmm, "vcvtdq2pd", (g->vcvtdq2pd(dst, y(src))), false, OT_FP64);
+    GEN(Zmm, "vcvtps2pd", (g->vcvtps2pd(dst, y(src))), false, OT_FP32);
+    GEN(Zmm, "vcvtpd2ps", (g->vcvtpd2ps(y(dst), src)), false, OT_FP64);
+    GEN(Zmm, "vcvtph2ps", (g->vcvtph2ps(dst, y(src))), false, OT_FP32);
+    GEN(Zmm, "vcvtps2ph", (g->vcvtps2ph(y(dst), src, 0)), false, OT_FP32);
+
+    if (info.have_avx512dq) {
+        GEN(Zmm, "vcvtqq2pd", (g->vcvtqq2pd(dst, src)), false, OT_FP64);
+        GEN(Zmm, "vcvtpd2qq", (g->vcvtpd2qq(dst, src)), false, OT_FP64);
+    }
+
+    /* zero/sign extension and truncating down conversion */
+    GEN(Zmm, "vpmovzxbd", (g->vpmovzxbd(dst, x(src))), false, OT_INT);
+    GEN(Zmm, "vpmovzxdq", (g->vpmovzxdq(dst, y(src))), false, OT_INT);
+    GEN(Zmm, "vpmovsxdq", (g->vpmovsxdq(dst, y(src))), false, OT_INT);
+    GEN(Zmm, "vpmovdb", (g->vpmovdb(x(dst), src)), false, OT_INT);
+    GEN(Zmm, "vpmovqd", (g->vpmovqd(y(dst), src)), false, OT_INT);
+
+    GEN(Zmm, "vpbroadcastd", (g->vpbroadcastd(dst, x(src))), false, OT_INT);
+    GEN_throughput_only(Zmm, "vpbroadcastd zmm,r32", (g->vpbroadcastd(dst, g->eax)), false, OT_INT);
+    GEN_latency_only(Zmm, "vmovd->vpbroadcastd r32",
+                     (g->vmovd(g->eax, x(src)));(g->vpbroadcastd(dst, g->eax)),
+                     false, OT_INT);
+
+    GEN(Zmm, "vinserti32x4", (g->vinserti32x4(dst, dst, x(src), 1)), false, OT_INT);
+    GEN(Zmm, "vextracti32x4", (g->vextracti32x4(x(dst), src, 1)), false, OT_INT);
+    GEN(Zmm, "vinserti64x4", (g->vinserti64x4(dst, dst, y(src), 1)), false, OT_INT);
+    GEN(Zmm, "vextracti64x4", (g->vextracti64x4(y(dst), src, 1)), false, OT_INT);
+}
+
+void test_conv()
+{
+    test_conv_sse();
+    test_conv_avx();
+    test_conv_avx512();
+}
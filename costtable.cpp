@@ -0,0 +1,263 @@
+#include "common.hpp"
+
+/*
+ * cost table header (--emit-header FILE)
+ *
+ * latency/throughput rows of lt() are merged per (instruction, width) and
+ * written as a constexpr table in a namespace named after the cpuid
+ * signature:
+ *
+ *   ibench_cost::sig_000906e9::entries[]  {inst, width, latency, rthroughput, uops}
+ *   ibench_cost::sig_000906e9::lookup()   constexpr, nullptr if not measured
+ *   ibench_cost::sig_000906e9::tbl        signature, brand, entries
+ *
+ * Headers from several hosts can be included together. The shared part
+ * (entry/table types, find, host_table) is guarded once. host_table() picks the
+ * table for the running cpu : exact signature, then same family/model.
+ *
+ * width is the class column ("m256", "reg64", "m256@cpu_atom" on hybrid
+ * cpus). Values are cycles, uops per instruction. -1 : not measured.
+ */
+
+#define COSTTABLE_MAX 4096
+
+struct cost_row {
+    char width[64];
+    char inst[128];
+    double latency;
+    double rthroughput;
+    double uops;
+};
+
+static cost_row rows[COSTTABLE_MAX];
+static int num_row;
+
+void
+costtable_add(const char *width, const char *inst, const char *on, const lt_result &r)
+{
+    bool latency = strcmp(on, "latency") == 0;
+    if (!latency && strcmp(on, "throughput") != 0) {
+        return;
+    }
+
+    cost_row *row = NULL;
+    for (int i=0; i<num_row; i++) {
+        if (strcmp(rows[i].width, width) == 0 && strcmp(rows[i].inst, inst) == 0) {
+            row = &rows[i];
+            break;
+        }
+    }
+
+    if (row == NULL) {
+        if (num_row == COSTTABLE_MAX) {
+            fprintf(stderr, "emit-header : more than %d instructions, %s dropped\n", COSTTABLE_MAX, inst);
+            return;
+        }
+
+        row = &rows[num_row++];
+        snprintf(row->width, sizeof(row->width), "%s", width);
+        snprintf(row->inst, sizeof(row->inst), "%s", inst);
+        row->latency = -1;
+        row->rthroughput = -1;
+        row->uops = -1;
+    }
+
+    if (latency) {
+        row->latency = r.cpi;
+    } else {
+        row->rthroughput = r.cpi;
+        row->uops = r.upi;
+    }
+}
+
+static double
+known(double v)
+{
+    return isfinite(v) ? v : -1;
+}
+
+static void
+put_string(FILE *fp, const char *s)
+{
+    fputc('"', fp);
+    for (; *s; s++) {
+        if (*s == '"' || *s == '\\') {
+            fputc('\\', fp);
+        }
+        fputc(*s, fp);
+    }
+    fputc('"', fp);
+}
+
+static const char common_part[] =
+    "#ifndef IBENCH_COST_COMMON\n"
+    "#define IBENCH_COST_COMMON\n"
+    "\n"
+    "#ifdef _MSC_VER\n"
+    "#include <intrin.h>\n"
+    "#else\n"
+    "#include <cpuid.h>\n"
+    "#endif\n"
+    "\n"
+    "namespace ibench_cost {\n"
+    "\n"
+    "struct entry {\n"
+    "    const char *inst;\n"
+    "    const char *width;\n"
+    "    double latency;         /* cycles, -1 : not measured */\n"
+    "    double rthroughput;     /* cycles per instruction, -1 : not measured */\n"
+    "    double uops;            /* per instruction, -1 : not measured */\n"
+    "};\n"
+    "\n"
+    "struct table {\n"
+    "    unsigned int signature; /* cpuid 1 eax */\n"
+    "    const char *brand;\n"
+    "    const entry *entries;\n"
+    "    int num_entry;\n"
+    "};\n"
+    "\n"
+    "constexpr bool\n"
+    "str_eq(const char *a, const char *b)\n"
+    "{\n"
+    "    return *a == *b && (*a == '\\0' || str_eq(a + 1, b + 1));\n"
+    "}\n"
+    "\n"
+    "constexpr const entry *find(const entry *e, int n, const char *inst, const char *width);\n"
+    "\n"
+    "constexpr const entry *\n"
+    "find_or(const entry *found, const entry *e, int n, const char *inst, const char *width)\n"
+    "{\n"
+    "    return found ? found : find(e, n, inst, width);\n"
+    "}\n"
+    "\n"
+    "/* halves the range, so recursion depth stays at log2(n) */\n"
+    "constexpr const entry *\n"
+    "find(const entry *e, int n, const char *inst, const char *width)\n"
+    "{\n"
+    "    return n == 0 ? nullptr :\n"
+    "        n == 1 ? ((str_eq(e->inst, inst) && str_eq(e->width, width)) ? e : nullptr) :\n"
+    "        find_or(find(e, n/2, inst, width), e + n/2, n - n/2, inst, width);\n"
+    "}\n"
+    "\n"
+    "inline const entry *\n"
+    "lookup(const table *t, const char *inst, const char *width)\n"
+    "{\n"
+    "    return t ? find(t->entries, t->num_entry, inst, width) : nullptr;\n"
+    "}\n"
+    "\n"
+    "inline unsigned int\n"
+    "host_signature()\n"
+    "{\n"
+    "#ifdef _MSC_VER\n"
+    "    int reg[4];\n"
+    "    __cpuid(reg, 1);\n"
+    "    return reg[0];\n"
+    "#else\n"
+    "    unsigned int a, b, c, d;\n"
+    "    __cpuid(1, a, b, c, d);\n"
+    "    return a;\n"
+    "#endif\n"
+    "}\n"
+    "\n"
+    "/* exact signature, then same family/model with another stepping. nullptr : no table */\n"
+    "inline const table *\n"
+    "host_table(const table *const *tables, int num_table)\n"
+    "{\n"
+    "    unsigned int sig = host_signature();\n"
+    "\n"
+    "    for (int i=0; i<num_table; i++) {\n"
+    "        if (tables[i]->signature == sig) {\n"
+    "            return tables[i];\n"
+    "        }\n"
+    "    }\n"
+    "    for (int i=0; i<num_table; i++) {\n"
+    "        if ((tables[i]->signature & 0x0fff0ff0) == (sig & 0x0fff0ff0)) {\n"
+    "            return tables[i];\n"
+    "        }\n"
+    "    }\n"
+    "    return nullptr;\n"
+    "}\n"
+    "\n"
+    "}\n"
+    "\n"
+    "#endif\n"
+    "\n";
+
+bool
+costtable_write(const char *path, const char *brand)
+{
+    if (num_row == 0) {
+        fprintf(stderr, "emit-header : no latency/throughput results, %s not written\n", path);
+        return false;
+    }
+
+    FILE *fp = fopen(path, "wb");
+    if (fp == NULL) {
+        perror(path);
+        return false;
+    }
+
+    unsigned int sig = info.signature;
+
+    fprintf(fp,
+            "/*\n"
+            " * instruction cost table, generated by bench --emit-header\n"
+            " *\n"
+            " *   cpu       : %s\n"
+            " *   signature : 0x%08x (cpuid 1 eax)\n"
+            " *\n"
+            " *   constexpr const ibench_cost::entry *e = ibench_cost::sig_%08x::lookup(\"vaddps\", \"m256\");\n"
+            " *\n"
+            " *   static const ibench_cost::table *tables[] = {&ibench_cost::sig_%08x::tbl, ...};\n"
+            " *   const ibench_cost::table *t = ibench_cost::host_table(tables, num_table);\n"
+            " *   const ibench_cost::entry *e = ibench_cost::lookup(t, \"vaddps\", \"m256\");\n"
+            " */\n"
+            "\n",
+            brand, sig, sig, sig);
+
+    fputs(common_part, fp);
+
+    fprintf(fp,
+            "#ifndef IBENCH_COST_%08X\n"
+            "#define IBENCH_COST_%08X\n"
+            "\n"
+            "namespace ibench_cost {\n"
+            "namespace sig_%08x {\n"
+            "\n"
+            "constexpr entry entries[] = {\n",
+            sig, sig, sig);
+
+    for (int i=0; i<num_row; i++) {
+        cost_row *row = &rows[i];
+
+        fputs("    {", fp);
+        put_string(fp, row->inst);
+        fputs(", ", fp);
+        put_string(fp, row->width);
+        fprintf(fp, ", %.3f, %.3f, %.3f},\n", known(row->latency), known(row->rthroughput), known(row->uops));
+    }
+
+    fprintf(fp,
+            "};\n"
+            "\n"
+            "constexpr int num_entry = sizeof(entries)/sizeof(entries[0]);\n"
+            "constexpr table tbl = {0x%08x, ",
+            sig);
+    put_string(fp, brand);
+    fprintf(fp,
+            ", entries, num_entry};\n"
+            "\n"
+            "constexpr const entry *\n"
+            "lookup(const char *inst, const char *width)\n"
+            "{\n"
+            "    return find(entries, num_entry, inst, width);\n"
+            "}\n"
+            "\n"
+            "}\n"
+            "}\n"
+            "\n"
+            "#endif\n");
+
+    fclose(fp);
+    return true;
+}
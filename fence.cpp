@@ -0,0 +1,137 @@
+#include "common.hpp"
+
+/*
+ * fence, serialization and timestamp instructions.
+ *
+ * Each instruction is measured standalone, then following a block of
+ * outstanding stores/loads to zero_mem, so that the difference against
+ * the bare "4x store"/"4x load" blocks shows how much memory work the
+ * fence has to drain.
+ */
+
+/* rdi is always zero inside Gen, so zero_mem stays zero */
+static void
+store4(Xbyak::CodeGenerator *g)
+{
+    g->mov(g->ptr[g->rdx + 0], g->rdi);
+    g->mov(g->ptr[g->rdx + 64], g->rdi);
+    g->mov(g->ptr[g->rdx + 128], g->rdi);
+    g->mov(g->ptr[g->rdx + 192], g->rdi);
+}
+
+static void
+load4(Xbyak::CodeGenerator *g, Xbyak::Reg64 r)
+{
+    g->mov(r, g->ptr[g->rdx + 0]);
+    g->mov(r, g->ptr[g->rdx + 64]);
+    g->mov(r, g->ptr[g->rdx + 128]);
+    g->mov(r, g->ptr[g->rdx + 192]);
+}
+
+/* cpuid clobbers eax/ebx/ecx/edx. rcx is loop counter, rdx is zero_mem, rbx is callee saved */
+static void
+cpuid_keep(Xbyak::CodeGenerator *g)
+{
+    g->push(g->rbx);
+    g->push(g->rcx);
+    g->push(g->rdx);
+    g->xor_(g->eax, g->eax);
+    g->cpuid();
+    g->pop(g->rdx);
+    g->pop(g->rcx);
+    g->pop(g->rbx);
+}
+
+/* rdtsc clobbers eax/edx, rdtscp also ecx. tmp is saved by Gen */
+static void
+rdtsc_keep(Xbyak::CodeGenerator *g, Xbyak::Reg64 tmp)
+{
+    g->mov(tmp, g->rdx);
+    g->rdtsc();
+    g->mov(g->rdx, tmp);
+}
+
+static void
+rdtscp_keep(Xbyak::CodeGenerator *g, Xbyak::Reg64 tmp)
+{
+    g->mov(tmp, g->rdx);
+    g->push(g->rcx);
+    g->rdtscp();
+    g->pop(g->rcx);
+    g->mov(g->rdx, tmp);
+}
+
+static void
+serialize(Xbyak::CodeGenerator *g)
+{
+    /* serialize : NP 0F 01 E8 */
+    g->db(0x0f);
+    g->db(0x01);
+    g->db(0xe8);
+}
+
+static void
+lock_add(Xbyak::CodeGenerator *g)
+{
+    g->lock();
+    g->add(g->qword[g->rdx + 256], 0);
+}
+
+void test_fence()
+{
+    /* standalone */
+    GEN_throughput_only(Reg64, "mfence", (g->mfence()), false, OT_INT);
+    GEN_throughput_only(Reg64, "lfence", (g->lfence()), false, OT_INT);
+    GEN_throughput_only(Reg64, "sfence", (g->sfence()), false, OT_INT);
+    GEN_throughput_only(Reg64, "pause", (g->pause()), false, OT_INT);
+    GEN_throughput_only(Reg64, "lock add [mem],0", (lock_add(g)), false, OT_INT);
+    GEN_throughput_only(Reg64, "xchg [mem],reg", (g->xchg(g->ptr[g->rdx + 256], dst)), false, OT_INT);
+    GEN_throughput_only(Reg64, "cpuid", (cpuid_keep(g)), false, OT_INT);
+    GEN_throughput_only(Reg64, "rdtsc", (rdtsc_keep(g, dst)), false, OT_INT);
+    if (info.have_rdtscp) {
+        GEN_throughput_only(Reg64, "rdtscp", (rdtscp_keep(g, dst)), false, OT_INT);
+    }
+    if (info.have_serialize) {
+        GEN_throughput_only(Reg64, "serialize", (serialize(g)), false, OT_INT);
+    }
+
+    /* fence after outstanding stores */
+    GEN_throughput_only(Reg64, "4x store", (store4(g)), false, OT_INT);
+    GEN_throughput_only(Reg64, "4x store + mfence", (store4(g)); (g->mfence()), false, OT_INT);
+    GEN_throughput_only(Reg64, "4x store + sfence", (store4(g)); (g->sfence()), false, OT_INT);
+    GEN_throughput_only(Reg64, "4x store + lfence", (store4(g)); (g->lfence()), false, OT_INT);
+    GEN_throughput_only(Reg64, "4x store + lock add", (store4(g)); (lock_add(g)), false, OT_INT);
+    GEN_throughput_only(Reg64, "4x store + pause", (store4(g)); (g->pause()), false, OT_INT);
+    GEN_throughput_only(Reg64, "4x store + rdtsc", (store4(g)); (rdtsc_keep(g, dst)), false, OT_INT);
+    if (info.have_rdtscp) {
+        GEN_throughput_only(Reg64, "4x store + rdtscp", (store4(g)); (rdtscp_keep(g, dst)), false, OT_INT);
+    }
+    if (info.have_serialize) {
+        GEN_throughput_only(Reg64, "4x store + serialize", (store4(g)); (serialize(g)), false, OT_INT);
+    }
+
+    /* fence after outstanding loads */
+    GEN_throughput_only(Reg64, "4x load", (load4(g, dst)), false, OT_INT);
+    GEN_throughput_only(Reg64, "4x load + mfence", (load4(g, dst)); (g->mfence()), false, OT_INT);
+    GEN_throughput_only(Reg64, "4x load + lfence", (load4(g, dst)); (g->lfence()), false, OT_INT);
+    GEN_throughput_only(Reg64, "4x load + sfence", (load4(g, dst)); (g->sfence()), false, OT_INT);
+    GEN_throughput_only(Reg64, "4x load + lock add", (load4(g, dst)); (lock_add(g)), false, OT_INT);
+    GEN_throughput_only(Reg64, "4x load + rdtsc", (load4(g, dst)); (rdtsc_keep(g, dst)), false, OT_INT);
+    if (info.have_rdtscp) {
+        GEN_throughput_only(Reg64, "4x load + rdtscp", (load4(g, dst)); (rdtscp_keep(g, dst)), false, OT_INT);
+    }
+
+    /* fence inside a load->load dependency chain */
+    GEN_latency_only(Reg64, "load",
+                     (g->mov(dst, g->ptr[src + g->rdx])),
+                     false, OT_INT);
+    GEN_latency_only(Reg64, "load + mfence",
+                     (g->mov(dst, g->ptr[src + g->rdx])); (g->mfence()),
+                     false, OT_INT);
+    GEN_latency_only(Reg64, "load + lfence",
+                     (g->mov(dst, g->ptr[src + g->rdx])); (g->lfence()),
+                     false, OT_INT);
+    GEN_latency_only(Reg64, "store->load + mfence",
+                     (g->mov(g->ptr[src + g->rdx + 64], g->rdi)); (g->mfence()); (g->mov(dst, g->ptr[src + g->rdx])),
+                     false, OT_INT);
+}
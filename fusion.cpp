@@ -0,0 +1,115 @@
+#include "common.hpp"
+
+/*
+ * macro-fusion (alu + jcc) and micro-fusion / unlamination of memory operands.
+ *
+ * Needs the fused domain uops counter (uops_fd). lt() keeps uops per
+ * instruction in lt_result.upi without printing it, so it is reported here
+ * as one row per block : "uops fused" (< 1.5) or "uops unfused". The value
+ * is corrected for the loop overhead (dec+jnz) using a nop kernel, which
+ * is exactly 1 uop per instruction.
+ *
+ * All branches are never taken and jump to the next instruction.
+ * rdx is zero_mem and rdi is zero inside Gen, so [rdx+rdi*4] hits the
+ * same line as [rdx].
+ */
+
+#define JCC_NEXT(jcc)                           \
+    {                                           \
+        Xbyak::Label next;                      \
+        g->jcc(next);                           \
+        g->L(next);                             \
+    }
+
+static double reg64_overhead;
+static double vec_overhead;
+
+template <typename RegType>
+static void
+fusion(const char *name, lt_result r)
+{
+    RegMap<RegType> rm;
+    double overhead = rm.vec_reg() ? vec_overhead : reg64_overhead;
+    double uops = r.upi - overhead;
+
+    report_value(rm.name, name, uops < 1.5 ? "uops fused" : "uops unfused", uops);
+}
+
+#define MACRO(name, expr)                                               \
+    fusion<Xbyak::Reg64>(name,                                          \
+           GEN_lt(Reg64, name, "throughput", expr, LT_THROUGHPUT, OT_INT))
+
+#define MICRO(rt, name, expr, ot)                                       \
+    fusion<Xbyak::rt>(name,                                             \
+           GEN_lt(rt, name, "throughput", expr, LT_THROUGHPUT, ot))
+
+void test_fusion()
+{
+    if (uops_fd == -1) {
+        fprintf(stderr, "fusion : no uops counter for this cpu, skipped\n");
+        return;
+    }
+
+    reg64_overhead = GEN_lt(Reg64, "nop", "throughput", (g->nop()), LT_THROUGHPUT, OT_INT).upi - 1;
+    vec_overhead = GEN_lt(Xmm, "nop", "throughput", (g->nop()), LT_THROUGHPUT, OT_INT).upi - 1;
+
+    /* macro fusion */
+    MACRO("cmp r,r + jne", (g->cmp(dst, src)); JCC_NEXT(jne));
+    MACRO("cmp r,imm + je", (g->cmp(dst, 1)); JCC_NEXT(je));
+    MACRO("cmp r,[mem] + jne", (g->cmp(dst, g->ptr[g->rdx])); JCC_NEXT(jne));
+    MACRO("cmp [mem],imm + jne", (g->cmp(g->qword[g->rdx], 0)); JCC_NEXT(jne));
+    MACRO("cmp r,r + jb", (g->cmp(dst, src)); JCC_NEXT(jb));
+    MACRO("cmp r,r + jl", (g->cmp(dst, src)); JCC_NEXT(jl));
+    MACRO("cmp r,r + jo", (g->cmp(dst, src)); JCC_NEXT(jo));
+    MACRO("test r,r + jne", (g->test(dst, src)); JCC_NEXT(jne));
+    MACRO("test r,imm + jne", (g->test(dst, 1)); JCC_NEXT(jne));
+    MACRO("add r,r + jne", (g->add(dst, src)); JCC_NEXT(jne));
+    MACRO("add r,imm + jb", (g->add(dst, 0)); JCC_NEXT(jb));
+    MACRO("sub r,imm + jne", (g->sub(dst, 0)); JCC_NEXT(jne));
+    MACRO("and r,r + jne", (g->and_(dst, src)); JCC_NEXT(jne));
+    MACRO("or r,r + jne", (g->or_(dst, src)); JCC_NEXT(jne));
+    MACRO("xor r,imm + jne", (g->xor_(dst, 0)); JCC_NEXT(jne));
+    MACRO("inc r + je", (g->inc(dst)); JCC_NEXT(je));
+    MACRO("dec r + je", (g->dec(dst)); JCC_NEXT(je));
+
+    /* micro fusion / unlamination, by addressing mode */
+    /* plain load is always 1 uop, reference for the load-op forms */
+    report_value("reg64", "mov r,[base]", "uops",
+                 GEN_lt(Reg64, "mov r,[base]", "throughput",
+                        (g->mov(dst, g->ptr[g->rdx])), LT_THROUGHPUT, OT_INT).upi - reg64_overhead);
+    MICRO(Reg64, "add r,[base]", (g->add(dst, g->ptr[g->rdx])), OT_INT);
+    MICRO(Reg64, "add r,[base+disp]", (g->add(dst, g->ptr[g->rdx + 64])), OT_INT);
+    MICRO(Reg64, "add r,[base+index*4]", (g->add(dst, g->ptr[g->rdx + g->rdi*4])), OT_INT);
+    MICRO(Reg64, "add r,[base+index*4+disp]", (g->add(dst, g->ptr[g->rdx + g->rdi*4 + 64])), OT_INT);
+    MICRO(Reg64, "mov [base],r", (g->mov(g->ptr[g->rdx + 128], g->rdi)), OT_INT);
+    MICRO(Reg64, "mov [base+index*4],r", (g->mov(g->ptr[g->rdx + g->rdi*4 + 128], g->rdi)), OT_INT);
+
+    MICRO(Xmm, "paddd x,[base]", (g->paddd(dst, g->ptr[g->rdx])), OT_INT);
+    MICRO(Xmm, "paddd x,[base+disp]", (g->paddd(dst, g->ptr[g->rdx + 64])), OT_INT);
+    MICRO(Xmm, "paddd x,[base+index*4]", (g->paddd(dst, g->ptr[g->rdx + g->rdi*4])), OT_INT);
+    MICRO(Xmm, "addps x,[base+index*4+disp]", (g->addps(dst, g->ptr[g->rdx + g->rdi*4 + 64])), OT_FP32);
+
+    if (info.have_avx) {
+        MICRO(Ymm, "vaddps y,y,[base]", (g->vaddps(dst, src, g->ptr[g->rdx])), OT_FP32);
+        MICRO(Ymm, "vaddps y,y,[base+disp]", (g->vaddps(dst, src, g->ptr[g->rdx + 64])), OT_FP32);
+        MICRO(Ymm, "vaddps y,y,[base+index*4]", (g->vaddps(dst, src, g->ptr[g->rdx + g->rdi*4])), OT_FP32);
+        MICRO(Ymm, "vaddps y,y,[base+index*4+disp]", (g->vaddps(dst, src, g->ptr[g->rdx + g->rdi*4 + 64])), OT_FP32);
+    }
+
+    if (info.have_fma) {
+        MICRO(Ymm, "vfmaps y,y,[base]", (g->vfmadd231ps(dst, src, g->ptr[g->rdx])), OT_FP32);
+        MICRO(Ymm, "vfmaps y,y,[base+index*4]", (g->vfmadd231ps(dst, src, g->ptr[g->rdx + g->rdi*4])), OT_FP32);
+    }
+
+    if (info.have_avx512f) {
+        MICRO(Zmm, "vaddps reg, reg, [base]", (g->vaddps(dst, src, g->ptr[g->rdx])), OT_FP32);
+        MICRO(Zmm, "vaddps reg, reg, [base+disp]", (g->vaddps(dst, src, g->ptr[g->rdx + 64])), OT_FP32);
+        MICRO(Zmm, "vaddps reg, reg, [base+index*4]", (g->vaddps(dst, src, g->ptr[g->rdx + g->rdi*4])), OT_FP32);
+        MICRO(Zmm, "vaddps reg, reg, [base+index*4+disp]", (g->vaddps(dst, src, g->ptr[g->rdx + g->rdi*4 + 64])), OT_FP32);
+    }
+
+    if (info.have_avx512dq) {
+        MICRO(Zmm, "vorps reg, reg, [base]", (g->vorps(dst, src, g->ptr[g->rdx])), OT_FP32);
+        MICRO(Zmm, "vorps reg, reg, [base+index*4]", (g->vorps(dst, src, g->ptr[g->rdx + g->rdi*4])), OT_FP32);
+    }
+}
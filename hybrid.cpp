@@ -0,0 +1,177 @@
+#include "common.hpp"
+
+/*
+ * hybrid (P-core/E-core) topology
+ *
+ * Each core type is read from the perf PMU directories the kernel
+ * creates on hybrid parts:
+ *
+ *   <sysfs>/devices/cpu_core/{cpus,type}
+ *   <sysfs>/devices/cpu_atom/{cpus,type}
+ *
+ * "type" is the PMU type that cycle counters must be opened on. If the
+ * PMUs are not there but cpuid says the part is hybrid, cpus are grouped
+ * by CPUID.1A:EAX[31:24] (0x40 core, 0x20 atom) and counters use the
+ * generic PMU type.
+ *
+ * <sysfs> is /sys, or --sysfs-root=DIR to run against a faked topology.
+ */
+
+/* "0-7,16,18-19" */
+static int
+parse_cpulist(const char *s, int *cpus, int max)
+{
+    int n = 0;
+
+    while (*s && *s != '\n') {
+        char *end;
+        long a = strtol(s, &end, 10);
+        if (end == s) {
+            break;
+        }
+
+        long b = a;
+        s = end;
+        if (*s == '-') {
+            b = strtol(s + 1, &end, 10);
+            s = end;
+        }
+
+        for (long c=a; c<=b && n<max; c++) {
+            cpus[n++] = c;
+        }
+
+        if (*s == ',') {
+            s++;
+        }
+    }
+
+    return n;
+}
+
+static bool
+read_line(const char *path, char *buf, size_t len)
+{
+    FILE *fp = fopen(path, "r");
+    if (fp == NULL) {
+        return false;
+    }
+
+    bool ok = fgets(buf, len, fp) != NULL;
+    fclose(fp);
+    return ok;
+}
+
+static int
+topology_from_sysfs(const char *root, core_type *types, int max)
+{
+    static const char *pmus[] = {"cpu_core", "cpu_atom"};
+    char path[512], buf[4096];
+    int n = 0;
+
+    for (size_t i=0; i<sizeof(pmus)/sizeof(pmus[0]) && n<max; i++) {
+        core_type *t = &types[n];
+
+        snprintf(path, sizeof(path), "%s/devices/%s/cpus", root, pmus[i]);
+        if (!read_line(path, buf, sizeof(buf))) {
+            continue;
+        }
+        t->num_cpu = parse_cpulist(buf, t->cpus, HYBRID_MAX_CPU);
+
+        snprintf(path, sizeof(path), "%s/devices/%s/type", root, pmus[i]);
+        t->pmu_type = 0;
+        if (read_line(path, buf, sizeof(buf))) {
+            t->pmu_type = atoi(buf);
+        }
+
+        snprintf(t->name, sizeof(t->name), "%s", pmus[i]);
+
+        if (t->num_cpu > 0) {
+            n++;
+        }
+    }
+
+    return n;
+}
+
+#ifdef __linux
+
+#include <sched.h>
+#include <cpuid.h>
+
+static int
+topology_from_cpuid(core_type *types, int max)
+{
+    unsigned int a, b, c, d;
+
+    __cpuid_count(7, 0, a, b, c, d);
+    if (!(d & (1<<15))) {
+        return 0;               /* not hybrid */
+    }
+
+    cpu_set_t orig;
+    if (sched_getaffinity(0, sizeof(orig), &orig) != 0) {
+        return 0;
+    }
+
+    int n = 0;
+    for (int cpu=0; cpu<CPU_SETSIZE && cpu<HYBRID_MAX_CPU; cpu++) {
+        if (!CPU_ISSET(cpu, &orig)) {
+            continue;
+        }
+
+        cpu_set_t one;
+        CPU_ZERO(&one);
+        CPU_SET(cpu, &one);
+        if (sched_setaffinity(0, sizeof(one), &one) != 0) {
+            continue;
+        }
+
+        __cpuid_count(0x1a, 0, a, b, c, d);
+        int kind = a >> 24;
+        const char *name = (kind == 0x40) ? "cpu_core" : (kind == 0x20) ? "cpu_atom" : "unknown";
+
+        int ti;
+        for (ti=0; ti<n; ti++) {
+            if (strcmp(types[ti].name, name) == 0) {
+                break;
+            }
+        }
+        if (ti == n) {
+            if (n == max) {
+                continue;
+            }
+            snprintf(types[n].name, sizeof(types[n].name), "%s", name);
+            types[n].pmu_type = 0;
+            types[n].num_cpu = 0;
+            n++;
+        }
+
+        types[ti].cpus[types[ti].num_cpu++] = cpu;
+    }
+
+    sched_setaffinity(0, sizeof(orig), &orig);
+    return n;
+}
+
+#else
+
+static int
+topology_from_cpuid(core_type *, int)
+{
+    return 0;
+}
+
+#endif
+
+int
+hybrid_topology(const char *sysfs_root, core_type *types, int max)
+{
+    int n = topology_from_sysfs(sysfs_root ? sysfs_root : "/sys", types, max);
+
+    if (n == 0 && sysfs_root == NULL) {
+        n = topology_from_cpuid(types, max);
+    }
+
+    return n;
+}
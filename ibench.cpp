@@ -0,0 +1,311 @@
+#include <immintrin.h>
+#include <x86intrin.h>
+#include <cpuid.h>
+#include "ibench.hpp"
+
+/*
+ * libibench state : counters, feature flags and the shared buffers that
+ * generated code reads from (rdx = zero_mem).
+ */
+
+cpuinfo info;
+int perf_fd = -1;
+int uops_fd = -1;
+int loop_align_offset = -1;
+int cycle_pmu_type = 0;
+gen_hook_t gen_prologue_hook = NULL;
+gen_hook_t gen_epilogue_hook = NULL;
+
+char MIE_ALIGN(2048*1024) zero_mem[4096*1024];
+char MIE_ALIGN(2048*1024) data_mem[4096*1024];
+
+static void
+cpu_detect(void)
+{
+    int reg[4];
+
+#ifdef _WIN32
+    __cpuid(reg, 0);
+#else
+    __cpuid(0, reg[0], reg[1], reg[2], reg[3]);
+#endif
+    /* vendor string is ebx,edx,ecx */
+    if (reg[1] == 0x756e6547 && reg[3] == 0x49656e69 && reg[2] == 0x6c65746e) {
+        info.intel = true;  /* GenuineIntel */
+    }
+    if (reg[1] == 0x68747541 && reg[3] == 0x69746e65 && reg[2] == 0x444d4163) {
+        info.amd = true;    /* AuthenticAMD */
+    }
+
+#ifdef _WIN32
+    __cpuidex(reg, 7, 0);
+#else
+    __cpuid_count(7, 0, reg[0], reg[1], reg[2], reg[3]);
+#endif
+
+    if (reg[1] & (1<<3)) {
+        info.have_bmi1 = true;
+    }
+
+    if (reg[1] & (1<<5)) {
+        info.have_avx2 = true;
+    }
+
+    if (reg[1] & (1<<8)) {
+        info.have_bmi2 = true;
+    }
+
+    if (reg[1] & (1<<9)) {
+        info.have_ermsb = true;
+    }
+
+    if (reg[1] & (1<<16)) {
+        info.have_avx512f = true;
+    }
+
+    if (reg[1] & (1<<17)) {
+        info.have_avx512dq = true;
+    }
+
+    if (reg[1] & (1<<27)) {
+        info.have_avx512er = true;
+    }
+
+    if (reg[1] & (1<<19)) {
+        info.have_adx = true;
+    }
+
+    if (reg[3] & (1<<4)) {
+        info.have_fsrm = true;
+    }
+
+    if (reg[3] & (1<<14)) {
+        info.have_serialize = true;
+    }
+
+#ifdef _WIN32
+    __cpuid(reg, 1);
+#else
+    __cpuid(1, reg[0], reg[1], reg[2], reg[3]);
+#endif
+    info.signature = reg[0];
+
+    if (reg[2] & (1<<1)) {
+        info.have_pclmulqdq = true;
+    }
+
+    if (reg[2] & (1<<12)) {
+        info.have_fma = true;
+    }
+
+
+    if (reg[2] & (1<<19)) {
+        info.have_sse41 = true;
+    }
+
+    if (reg[2] & (1<<20)) {
+        info.have_sse42 = true;
+    }
+
+    if (reg[2] & (1<<28)) {
+        info.have_avx = true;
+    }
+
+    if (reg[2] & (1<<29)) {
+        info.have_f16c = true;
+    }
+
+    if (reg[2] & (1<<23)) {
+        info.have_popcnt = true;
+    }
+
+    if (reg[2] & (1<<25)) {
+        info.have_aes = true;
+    }
+
+    if (info.have_avx512f) {
+        if (reg[2] & (1<<11)) {
+            info.have_avx512vnni = true;
+        }
+    }
+
+#ifdef _WIN32
+    __cpuidex(reg, 7, 1);
+#else
+    __cpuid_count(7, 1, reg[0], reg[1], reg[2], reg[3]);
+#endif
+
+    if (reg[0] & (1<<5)) {
+        info.have_avx512bf16 = true;
+    }
+
+#ifdef _WIN32
+    __cpuid(reg, 0x80000001);
+#else
+    __cpuid(0x80000001, reg[0], reg[1], reg[2], reg[3]);
+#endif
+
+    if (reg[3] & (1<<27)) {
+        info.have_rdtscp = true;
+    }
+
+    if (reg[2] & (1<<5)) {
+        info.have_lzcnt = true;
+    }
+}
+
+#ifdef __linux
+
+int
+perf_event_open(struct perf_event_attr *hw_event, pid_t pid,
+                int cpu, int group_fd, unsigned long flags )
+{
+    int ret;
+
+    ret = syscall( __NR_perf_event_open, hw_event, pid, cpu,
+                   group_fd, flags );
+    return ret;
+}
+
+int
+cycle_counter_open(void)
+{
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.size = sizeof(attr);
+    attr.config = PERF_COUNT_HW_CPU_CYCLES;
+    attr.exclude_kernel = 1;
+
+    if (cycle_pmu_type > 0) {
+        /* extended hardware type (PERF_PMU_TYPE_SHIFT) */
+        attr.config |= (unsigned long long)cycle_pmu_type << 32;
+
+        int fd = perf_event_open(&attr, 0, -1, -1, 0);
+        if (fd != -1) {
+            return fd;
+        }
+        attr.config = PERF_COUNT_HW_CPU_CYCLES;
+    }
+
+    return perf_event_open(&attr, 0, -1, -1, 0);
+}
+
+/*
+ * fused domain uops.
+ *  intel : UOPS_ISSUED.ANY (event=0x0e, umask=0x01). micro/macro fused pair counts as 1
+ *  amd   : retired macro ops (PMCx0C1)
+ */
+static void
+uops_counter_init(void)
+{
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+
+    attr.type = PERF_TYPE_RAW;
+    attr.size = sizeof(attr);
+    attr.exclude_kernel = 1;
+
+    if (cycle_pmu_type > 0) {
+        attr.type = cycle_pmu_type;
+    }
+
+    if (info.intel) {
+        attr.config = 0x010e;
+    } else if (info.amd) {
+        attr.config = 0x00c1;
+    } else {
+        return;
+    }
+
+    uops_fd = perf_event_open(&attr, 0, -1, -1, 0);
+    if (uops_fd == -1) {
+        perror("perf_event_open(uops)");
+    }
+}
+
+int sw_fd[IB_NUM_SW_EVENT] = {-1, -1, -1};
+
+/*
+ * kernel side counting is tried first : context switches are recorded in
+ * the kernel and don't show up with exclude_kernel. with
+ * perf_event_paranoid >= 2 only the user side (page faults) is left.
+ */
+static void
+sw_counter_init(void)
+{
+    static const unsigned long long config[IB_NUM_SW_EVENT] = {
+        PERF_COUNT_SW_CONTEXT_SWITCHES,
+        PERF_COUNT_SW_CPU_MIGRATIONS,
+        PERF_COUNT_SW_PAGE_FAULTS,
+    };
+
+    for (int i=0; i<IB_NUM_SW_EVENT; i++) {
+        struct perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+
+        attr.type = PERF_TYPE_SOFTWARE;
+        attr.size = sizeof(attr);
+        attr.config = config[i];
+
+        if (sw_fd[i] != -1) {
+            close(sw_fd[i]);
+        }
+
+        sw_fd[i] = perf_event_open(&attr, 0, -1, -1, 0);
+        if (sw_fd[i] == -1) {
+            attr.exclude_kernel = 1;
+            sw_fd[i] = perf_event_open(&attr, 0, -1, -1, 0);
+        }
+    }
+}
+
+bool
+ib_counters_init(bool want_uops)
+{
+    if (perf_fd != -1) {
+        close(perf_fd);
+    }
+    if (uops_fd != -1) {
+        close(uops_fd);
+        uops_fd = -1;
+    }
+
+    perf_fd = cycle_counter_open();
+    if (perf_fd == -1) {
+        return false;
+    }
+
+    if (want_uops) {
+        uops_counter_init();
+    }
+
+    sw_counter_init();
+
+    return true;
+}
+
+#else
+
+int
+cycle_counter_open(void)
+{
+    return -1;
+}
+
+bool
+ib_counters_init(bool)
+{
+    return true;
+}
+
+#endif
+
+bool
+ib_init(void)
+{
+    cpu_detect();
+
+    return ib_counters_init(true);
+}
@@ -0,0 +1,867 @@
+#ifndef IBENCH_HPP
+#define IBENCH_HPP
+
+/*
+ * libibench : JIT + perf counter measurement core of bench
+ *
+ *   ib_init();
+ *
+ *   ib_options opt;
+ *   opt.mode = LT_THROUGHPUT;
+ *   opt.num_chain = 4;
+ *   ib_result r = ib_measure<Xbyak::Ymm>(
+ *       [](Xbyak::CodeGenerator *g, Xbyak::Ymm dst, Xbyak::Ymm src){g->vaddps(dst, dst, src);},
+ *       opt);
+ *
+ * The callable emits one instruction (or a short sequence) per call, the
+ * same as the GEN() expressions in bench. Gen wraps it in the save/restore
+ * prologue and the counted loop. The result carries raw counters, derived
+ * values are left to the caller. Nothing here exits : r.ok is false when
+ * the cycle counter can't be read (ib_init() returned false, for one).
+ */
+
+#include <xbyak.h>
+#include <string.h>
+#include <stdio.h>
+#include <math.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <x86intrin.h>
+#endif
+
+struct cpuinfo {
+    bool have_sse41 = false;
+    bool have_sse42 = false;
+    bool have_f16c = false;
+    bool have_avx = false;
+    bool have_avx2 = false;
+    bool have_fma = false;
+    bool have_avx512f = false;
+    bool have_avx512dq = false;
+    bool have_avx512er = false;
+    bool have_avx512vnni = false;
+    bool have_avx512bf16 = false;
+    bool have_popcnt = false;
+    bool have_bmi1 = false;
+    bool have_bmi2 = false;
+    bool have_lzcnt = false;
+    bool have_aes = false;
+    bool have_pclmulqdq = false;
+    bool have_rdtscp = false;
+    bool have_serialize = false;
+    bool have_adx = false;
+    bool have_ermsb = false;
+    bool have_fsrm = false;
+    bool intel = false;
+    bool amd = false;
+    unsigned int signature = 0; /* cpuid 1 eax : family/model/stepping */
+};
+
+extern cpuinfo info;
+extern int perf_fd;
+extern int uops_fd;            /* -1 if no uops counter for this cpu */
+extern int loop_align_offset;   /* loop start offset in a 64byte line, -1 : align(16) */
+extern int cycle_pmu_type;      /* hybrid : pmu of the core type being measured, 0 : generic */
+
+/* code emitted by Gen right before the loop / right after it. NULL : none */
+typedef void (*gen_hook_t)(Xbyak::CodeGenerator *g);
+extern gen_hook_t gen_prologue_hook;
+extern gen_hook_t gen_epilogue_hook;
+
+/* user cycles of the calling thread. -1 on error */
+extern int cycle_counter_open(void);
+
+#ifdef __linux
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#include <asm/unistd.h>
+#include <sys/eventfd.h>
+
+extern int perf_event_open(struct perf_event_attr *hw_event, pid_t pid,
+                           int cpu, int group_fd, unsigned long flags);
+
+/* -1 on error (errno is set) */
+static inline long long
+read_cycle(void)
+{
+    long long val;
+    ssize_t sz = read(perf_fd, &val, sizeof(val));
+    if (sz != sizeof(val)) {
+        return -1;
+    }
+
+    return val;
+}
+
+/* -1 on error (errno is set) */
+static inline long long
+read_uops(void)
+{
+    long long val;
+    ssize_t sz = read(uops_fd, &val, sizeof(val));
+    if (sz != sizeof(val)) {
+        return -1;
+    }
+
+    return val;
+}
+
+/*
+ * context switches, cpu migrations, page faults.
+ * a timed run during which any of them moved is discarded.
+ */
+#define IB_NUM_SW_EVENT 3
+extern int sw_fd[IB_NUM_SW_EVENT];     /* -1 : not available */
+
+static inline long long
+read_sw_events(void)
+{
+    long long sum = 0;
+
+    for (int i=0; i<IB_NUM_SW_EVENT; i++) {
+        long long val;
+        if (sw_fd[i] != -1 && read(sw_fd[i], &val, sizeof(val)) == sizeof(val)) {
+            sum += val;
+        }
+    }
+
+    return sum;
+}
+
+#else
+
+#define read_cycle() __rdtsc()
+#define read_uops() 0LL
+#define read_sw_events() 0LL
+
+
+#endif
+
+extern char MIE_ALIGN(2048*1024) zero_mem[4096*1024];
+extern char MIE_ALIGN(2048*1024) data_mem[4096*1024];
+
+enum lt_op {
+    LT_LATENCY,
+    LT_THROUGHPUT,
+    LT_THROUGHPUT_KILLDEP
+};
+
+enum operand_type {
+    OT_INT,
+    OT_FP32,
+    OT_FP64
+};
+
+template <typename T> struct RegMap;
+
+template <>
+struct RegMap<Xbyak::Xmm>
+{
+    const char *name;
+    Xbyak::Xmm v4, v5, v6, v7;
+    Xbyak::Xmm v8, v9, v10, v11, v12, v13, v14, v15;
+
+    RegMap()
+        :name("m128"),
+         v4(4), v5(5), v6(6), v7(7),
+         v8(8), v9(9), v10(10), v11(11), v12(12), v13(13), v14(14), v15(15)
+        {}
+
+    bool vec_reg() {
+        return true;
+    }
+
+    void save(Xbyak::CodeGenerator *g, Xbyak::Xmm r, int off, enum operand_type ot) {
+        switch (ot) {
+        case OT_INT:
+            g->movdqa(g->ptr [g->rsp + off], r);
+            break;
+        case OT_FP32:
+            g->movaps(g->ptr [g->rsp + off], r);
+            break;
+        case OT_FP64:
+            g->movapd(g->ptr [g->rsp + off], r);
+            break;
+        }
+    }
+
+    void restore(Xbyak::CodeGenerator *g, Xbyak::Xmm r, int off, enum operand_type ot) {
+        switch (ot) {
+        case OT_INT:
+            g->movdqa(r, g->ptr [g->rsp + off]);
+            break;
+        case OT_FP32:
+            g->movaps(r, g->ptr [g->rsp + off]);
+            break;
+        case OT_FP64:
+            g->movapd(r, g->ptr [g->rsp + off]);
+            break;
+        }
+    }
+
+    void killdep(Xbyak::CodeGenerator *g, Xbyak::Xmm r, enum operand_type ot) {
+        switch (ot) {
+        case OT_INT:
+            g->pxor(r, r);
+            break;
+        case OT_FP32:
+            g->xorps(r, r);
+            break;
+        case OT_FP64:
+            g->xorpd(r, r);
+            break;
+        }
+    }
+};
+
+template <>
+struct RegMap<Xbyak::Ymm>
+{
+    const char *name;
+
+    Xbyak::Ymm v4, v5, v6, v7;
+    Xbyak::Ymm v8, v9, v10, v11, v12, v13, v14, v15;
+
+    RegMap()
+        :name("m256"),
+         v4(4), v5(5), v6(6), v7(7),
+         v8(8), v9(9), v10(10), v11(11), v12(12), v13(13), v14(14), v15(15)
+        {}
+
+    bool vec_reg() {
+        return true;
+    }
+
+    void save(Xbyak::CodeGenerator *g, Xbyak::Ymm r, int off, enum operand_type ot) {
+        switch (ot) {
+        case OT_INT:
+            g->vmovdqa(g->ptr [g->rsp + off], r);
+            break;
+        case OT_FP32:
+            g->vmovaps(g->ptr [g->rsp + off], r);
+            break;
+        case OT_FP64:
+            g->vmovapd(g->ptr [g->rsp + off], r);
+            break;
+        }
+    }
+
+    void restore(Xbyak::CodeGenerator *g, Xbyak::Ymm r, int off, enum operand_type ot) {
+        switch (ot) {
+        case OT_INT:
+            g->vmovdqa(r, g->ptr [g->rsp + off]);
+            break;
+        case OT_FP32:
+            g->vmovaps(r, g->ptr [g->rsp + off]);
+            break;
+        case OT_FP64:
+            g->vmovapd(r, g->ptr [g->rsp + off]);
+            break;
+        }
+    }
+
+    void killdep(Xbyak::CodeGenerator *g, Xbyak::Ymm r, enum operand_type ot) {
+        switch (ot) {
+        case OT_INT:
+            g->vpxor(r, r, r);
+            break;
+        case OT_FP32:
+            g->vxorps(r, r, r);
+            break;
+        case OT_FP64:
+            g->vxorpd(r, r, r);
+            break;
+        }
+    }
+};
+
+template <>
+struct RegMap<Xbyak::Zmm>
+{
+    const char *name;
+    Xbyak::Zmm v4, v5, v6, v7;
+    Xbyak::Zmm v8, v9, v10, v11, v12, v13, v14, v15;
+    Xbyak::Zmm v16, v17, v18, v19, v20, v21, v22, v23;
+    Xbyak::Zmm v24, v25, v26, v27, v28, v29, v30, v31;
+
+    RegMap()
+        :name("m512"),
+         v4(4), v5(5), v6(6), v7(7),
+         v8(8), v9(9), v10(10), v11(11), v12(12), v13(13), v14(14), v15(15),
+         v16(16), v17(17), v18(18), v19(19), v20(20), v21(21), v22(22), v23(23),
+         v24(24), v25(25), v26(26), v27(27), v28(28), v29(29), v30(30), v31(31)
+        {}
+
+    bool vec_reg() {
+        return true;
+    }
+
+    void save(Xbyak::CodeGenerator *g, Xbyak::Ymm r, int off, enum operand_type ot) {
+        switch (ot) {
+        case OT_INT:
+            g->vmovdqa(g->ptr [g->rsp + off], r);
+            break;
+        case OT_FP32:
+            g->vmovaps(g->ptr [g->rsp + off], r);
+            break;
+        case OT_FP64:
+            g->vmovapd(g->ptr [g->rsp + off], r);
+            break;
+        }
+    }
+
+    void restore(Xbyak::CodeGenerator *g, Xbyak::Ymm r, int off, enum operand_type ot) {
+        switch (ot) {
+        case OT_INT:
+            g->vmovdqa(r, g->ptr [g->rsp + off]);
+            break;
+        case OT_FP32:
+            g->vmovaps(r, g->ptr [g->rsp + off]);
+            break;
+        case OT_FP64:
+            g->vmovapd(r, g->ptr [g->rsp + off]);
+            break;
+        }
+    }
+
+    void killdep(Xbyak::CodeGenerator *g, Xbyak::Ymm r, enum operand_type ot) {
+        switch (ot) {
+        case OT_INT:
+            g->vpxorq(r, r, r);
+            break;
+        case OT_FP32:
+            g->vpxorq(r, r, r);
+            break;
+        case OT_FP64:
+            g->vpxorq(r, r, r);
+            break;
+        }
+    }
+};
+
+
+
+template <>
+struct RegMap<Xbyak::Reg64>
+{
+    const char *name;
+    Xbyak::Reg64 v4, v5, v6, v7;
+    Xbyak::Reg64 v8, v9, v10, v11, v12, v13, v14, v15;
+
+    RegMap()
+        :name("reg64"),
+         v4(Xbyak::Operand::RSP),
+         v5(Xbyak::Operand::RBP),
+         v6(Xbyak::Operand::RSI),
+         v7(Xbyak::Operand::RDI),
+         v8(Xbyak::Operand::R8),
+         v9(Xbyak::Operand::R9),
+         v10(Xbyak::Operand::R10),
+         v11(Xbyak::Operand::R11),
+         v12(Xbyak::Operand::R12),
+         v13(Xbyak::Operand::R13),
+         v14(Xbyak::Operand::R14),
+         v15(Xbyak::Operand::R15)
+        {}
+
+    bool vec_reg() {
+        return false;
+    }
+
+    void save(Xbyak::CodeGenerator *g, Xbyak::Reg64 r, int off, enum operand_type ) {
+        g->mov(g->ptr[g->rsp + off], r);
+    }
+
+    void restore(Xbyak::CodeGenerator *g, Xbyak::Reg64 r, int off, enum operand_type ) {
+        g->mov(r, g->ptr[g->rsp + off]);
+    }
+
+    void killdep(Xbyak::CodeGenerator *g, Xbyak::Reg64 r, enum operand_type) {
+        g->xor_(r, r);
+    }
+
+};
+
+/* number of independent register chains used by throughput code. num_chain 0 : all of them */
+template <typename RegType> int
+throughput_chains(int num_chain)
+{
+    int max = RegMap<RegType>().vec_reg() ? 12 : 8;
+
+    if (num_chain <= 0 || num_chain > max) {
+        return max;
+    }
+    return num_chain;
+}
+
+template <typename RegType, typename Gen, typename F>
+struct gen_throughput{
+    void operator () (Gen *g, RegMap<RegType> &rm, F f, int num_insn, int num_chain){
+        RegType regs[] = {rm.v4, rm.v5, rm.v6, rm.v7,
+                          rm.v8, rm.v9, rm.v10, rm.v11, rm.v12, rm.v13, rm.v14, rm.v15};
+        RegType *r = regs;
+        if (!rm.vec_reg()) {
+            r = regs + 4;       /* v4-v7 are rsp,rbp,rsi,rdi */
+        }
+
+        num_chain = throughput_chains<RegType>(num_chain);
+        for (int ii=0; ii<num_insn/num_chain; ii++) {
+            for (int ci=0; ci<num_chain; ci++) {
+                f(g, r[ci], r[ci]);
+            }
+        }
+    }
+};
+
+
+template <typename RegType,
+          typename F>
+struct Gen
+    :public Xbyak::CodeGenerator
+{
+    /* offsets of the code from the prologue hook to the epilogue hook (ib_definition_hash) */
+    size_t kernel_begin, kernel_end;
+
+    Gen(F f, bool reserve_rcx, int num_loop, int num_insn, enum lt_op o, enum operand_type ot,
+        int num_chain = 0) {
+        RegMap<RegType> rm;
+
+        int reg_size = 64;
+        int num_reg = 12;
+
+        push(rbp);
+        mov(rbp, rsp);
+        and_(rsp, -(Xbyak::sint64)64);
+        sub(rsp, reg_size * (num_reg + 1));
+
+        if (rm.vec_reg()) {
+            rm.save(this, rm.v4,  -reg_size*12, ot);
+            rm.save(this, rm.v5,  -reg_size*11, ot);
+            rm.save(this, rm.v6,  -reg_size*10, ot);
+            rm.save(this, rm.v7,  -reg_size*9, ot);
+        }
+
+        rm.save(this, rm.v8,  -reg_size*8, ot);
+        rm.save(this, rm.v9,  -reg_size*7, ot);
+        rm.save(this, rm.v10, -reg_size*6, ot);
+        rm.save(this, rm.v11, -reg_size*5, ot);
+        rm.save(this, rm.v12, -reg_size*4, ot);
+        rm.save(this, rm.v13, -reg_size*3, ot);
+        rm.save(this, rm.v14, -reg_size*2, ot);
+        rm.save(this, rm.v15, -reg_size*1, ot);
+
+        if (rm.vec_reg()) {
+            rm.killdep(this, rm.v4, ot);
+            rm.killdep(this, rm.v5, ot);
+            rm.killdep(this, rm.v6, ot);
+            rm.killdep(this, rm.v7, ot);
+        }
+
+        rm.killdep(this, rm.v8, ot);
+        rm.killdep(this, rm.v9, ot);
+        rm.killdep(this, rm.v10, ot);
+        rm.killdep(this, rm.v11, ot);
+        rm.killdep(this, rm.v12, ot);
+        rm.killdep(this, rm.v13, ot);
+        rm.killdep(this, rm.v14, ot);
+        rm.killdep(this, rm.v15, ot);
+
+        Xbyak::Reg64 counter_reg = rcx;
+        if (reserve_rcx) {
+            counter_reg = rdx;
+            mov(rcx, 16);
+            mov(rax, 16);
+        } else {
+            mov(rdx, (intptr_t)zero_mem);
+        }
+
+        mov(counter_reg, num_loop);
+        mov(ptr[rsp], rdi);
+        xor_(rdi, rdi);
+
+        kernel_begin = getSize();
+        if (gen_prologue_hook) {
+            gen_prologue_hook(this);
+        }
+
+        if (loop_align_offset < 0) {
+            align(16);
+        } else {
+            align(64);
+            for (int i=0; i<loop_align_offset; i++) {
+                nop();
+            }
+        }
+        L("@@");
+
+        switch (o) {
+        case LT_LATENCY:
+            for (int ii=0; ii<num_insn; ii++) {
+                f(this, rm.v8, rm.v8);
+            }
+            break;
+
+        case LT_THROUGHPUT:
+            gen_throughput<RegType,Gen,F>()(this, rm, f, num_insn, num_chain);
+            break;
+
+        case LT_THROUGHPUT_KILLDEP:
+            gen_throughput<RegType,Gen,F>()(this, rm, f, num_insn, num_chain);
+
+            if (rm.vec_reg()) {
+                rm.killdep(this, rm.v4, ot);
+                rm.killdep(this, rm.v5, ot);
+                rm.killdep(this, rm.v6, ot);
+                rm.killdep(this, rm.v7, ot);
+                rm.killdep(this, rm.v8, ot);
+                rm.killdep(this, rm.v9, ot);
+                rm.killdep(this, rm.v10, ot);
+                rm.killdep(this, rm.v11, ot);
+                rm.killdep(this, rm.v12, ot);
+                rm.killdep(this, rm.v13, ot);
+                rm.killdep(this, rm.v14, ot);
+                rm.killdep(this, rm.v15, ot);
+            } else {
+                rm.killdep(this, rm.v8, ot);
+                rm.killdep(this, rm.v9, ot);
+                rm.killdep(this, rm.v10, ot);
+                rm.killdep(this, rm.v11, ot);
+                rm.killdep(this, rm.v12, ot);
+                rm.killdep(this, rm.v13, ot);
+                rm.killdep(this, rm.v14, ot);
+                rm.killdep(this, rm.v15, ot);
+                
+            }
+            break;
+        }
+
+        dec(counter_reg);
+        jnz("@b");
+
+        if (gen_epilogue_hook) {
+            gen_epilogue_hook(this);
+        }
+        kernel_end = getSize();
+
+        mov(rdi, ptr[rsp]);
+        if (rm.vec_reg()) {
+            rm.restore(this, rm.v4,  -reg_size*12, ot);
+            rm.restore(this, rm.v5,  -reg_size*11, ot);
+            rm.restore(this, rm.v6, -reg_size*10, ot);
+            rm.restore(this, rm.v7, -reg_size*9, ot);
+        }
+
+        rm.restore(this, rm.v8,  -reg_size*8, ot);
+        rm.restore(this, rm.v9,  -reg_size*7, ot);
+        rm.restore(this, rm.v10, -reg_size*6, ot);
+        rm.restore(this, rm.v11, -reg_size*5, ot);
+        rm.restore(this, rm.v12, -reg_size*4, ot);
+        rm.restore(this, rm.v13, -reg_size*3, ot);
+        rm.restore(this, rm.v14, -reg_size*2, ot);
+        rm.restore(this, rm.v15, -reg_size*1, ot);
+
+        mov(rsp, rbp);
+        pop(rbp);
+        ret();
+            
+        /*
+         * latency:
+         *
+         *       mov rcx, count
+         * loop:
+         *       op reg, reg
+         *       op reg, reg
+         *       ...
+         *       op reg, reg
+         *       dec rcx
+         *       jne loop
+         *
+         */
+
+        /*
+         * throughput
+         *
+         *       mov rcx, count
+         * loop:
+         *       op reg8, reg8
+         *       op reg9, reg9
+         *       ...
+         *       op reg15, reg15
+         *       op reg8, reg8
+         *       op reg9, reg9
+         *       ...
+         *       op reg15, reg15
+         *       ...
+         *       if kill_dep {
+         *       xor r8
+         *       xor r9
+         *       ...
+         *       xor r15
+         *       }
+         *       dec rcx
+         *       jne loop
+         *
+         */
+        
+    }
+};
+
+template <typename RegType> int get_num_insn(void) {
+    RegMap<RegType> rm;
+    if (rm.vec_reg()) {
+        return 36;
+    } else {
+        return 64;
+    }
+ }
+
+#define NUM_LOOP (16384*8)
+
+/*
+ * cycles/TSC of a timed run against a reference taken from two runs that
+ * agree (see ib_measure). user cycles stop while the kernel handles an
+ * interrupt and the core clock moves with turbo/thermal changes, TSC does
+ * neither.
+ */
+#define IB_FREQ_TOLERANCE 0.02
+#define IB_MAX_RETRY 8
+
+enum ib_quality {
+    IB_UNCHECKED,               /* not measured by ib_measure */
+    IB_CLEAN,                   /* no timed run was disturbed */
+    IB_RETRIED,                 /* clean after discarding disturbed runs */
+    IB_DISTURBED,               /* every run was disturbed, the fastest is reported */
+};
+
+static inline const char *
+ib_quality_name(enum ib_quality q)
+{
+    switch (q) {
+    case IB_CLEAN:
+        return "ok";
+    case IB_RETRIED:
+        return "retried";
+    case IB_DISTURBED:
+        return "disturbed";
+    default:
+        return "";
+    }
+}
+
+struct ib_options {
+    enum lt_op mode = LT_THROUGHPUT;
+    enum operand_type ot = OT_INT;
+    int num_loop = NUM_LOOP;
+    int num_insn = 0;           /* instructions per loop, 0 : get_num_insn<RegType>() */
+    int num_chain = 0;          /* throughput : independent register chains, 0 : all */
+    int trials = 1;             /* clean timed runs, the one with the fewest cycles is kept */
+    int max_retry = IB_MAX_RETRY;   /* disturbed runs re-measured before giving up */
+    bool reserve_rcx = false;   /* rcx=rax=16 for shifts/rep, counter moves to rdx */
+    const char *dump_path = NULL;   /* write the generated code to this file */
+};
+
+struct ib_result {
+    bool ok;                    /* false : a cycle counter read failed, nothing else is valid */
+    long long cycles;
+    long long uops;             /* -1 if uops_fd is not available */
+    long long insns;            /* instructions executed in the timed run */
+    double cpi;
+    double ipc;
+    double upi;                 /* -1 if uops_fd is not available */
+    enum ib_quality quality;
+    int retries;                /* disturbed runs discarded */
+};
+
+/* cpuid detection, cycle and uops counters. false if no cycle counter */
+extern bool ib_init(void);
+
+/* (re)opens the counters for the calling process on cycle_pmu_type. false if no cycle counter */
+extern bool ib_counters_init(bool want_uops);
+
+static inline void
+ib_keep_best(long long *best_cycles, long long *best_uops, long long cycles, long long uops)
+{
+    if (*best_cycles < 0 || cycles < *best_cycles) {
+        *best_cycles = cycles;
+        *best_uops = uops;
+    }
+}
+
+template <typename RegType, typename F>
+ib_result
+ib_measure(F f, const ib_options &opt)
+{
+    int num_insn = opt.num_insn > 0 ? opt.num_insn : get_num_insn<RegType>();
+
+    Gen<RegType,F> g(f, opt.reserve_rcx, opt.num_loop, num_insn, opt.mode, opt.ot, opt.num_chain);
+    typedef void (*func_t)(void);
+    func_t exec = (func_t)g.getCode();
+
+    if (opt.dump_path) {
+        FILE *fp = fopen(opt.dump_path, "wb");
+        if (fp) {
+            fwrite(g.getCode(), 1, g.getSize(), fp);
+            fclose(fp);
+        }
+    }
+
+    if (opt.mode != LT_LATENCY) {
+        int chains = throughput_chains<RegType>(opt.num_chain);
+        num_insn = num_insn / chains * chains;
+    }
+
+    memset(zero_mem, 0, sizeof(zero_mem));
+    memset(data_mem, ~0, sizeof(data_mem));
+
+    ib_result r;
+    r.ok = false;
+    r.cycles = -1;
+    r.uops = -1;
+    r.insns = (long long)num_insn * opt.num_loop;
+    r.cpi = NAN;
+    r.ipc = NAN;
+    r.upi = -1;
+    r.quality = IB_UNCHECKED;
+    r.retries = 0;
+
+    /* warm-up, not timed : the clock may still be ramping */
+    long long cb = read_cycle();
+    exec();
+    long long ce = read_cycle();
+    if (cb < 0 || ce < 0) {
+        return r;
+    }
+
+    /*
+     * reference cycles/TSC : two runs without software events that agree
+     * with each other. A run is held as pending until the next one
+     * confirms it. Later runs off the reference are disturbed, unless the
+     * run after one agrees with it : the clock changed for good and the
+     * pair becomes the new reference.
+     */
+    double ref = -1;
+    double pend_ratio = -1;             /* -1 : nothing pending */
+    long long pend_cycles = -1, pend_uops = -1;
+
+    long long dist_cycles = -1, dist_uops = -1;
+    int clean = 0;
+    int trials = opt.trials > 0 ? opt.trials : 1;
+
+    while (clean < trials && r.retries <= opt.max_retry) {
+        long long ub = 0, ue = 0;
+        long long sb = read_sw_events();
+        if (uops_fd != -1) {
+            ub = read_uops();
+        }
+
+        long long tb = __rdtsc();
+        long long b = read_cycle();
+        exec();
+        long long e = read_cycle();
+        long long te = __rdtsc();
+
+        if (uops_fd != -1) {
+            ue = read_uops();
+        }
+        long long se = read_sw_events();
+
+        if (b < 0 || e < 0) {
+            r.cycles = -1;
+            r.uops = -1;
+            return r;
+        }
+
+        long long cycles = e-b;
+        long long uops = (uops_fd != -1 && ub >= 0 && ue >= 0) ? ue-ub : -1;
+        double ratio = cycles/(double)(te-tb);
+
+        if (se != sb) {
+            ib_keep_best(&dist_cycles, &dist_uops, cycles, uops);
+            r.retries++;
+        } else if (ref >= 0 && fabs(ratio - ref) <= ref * IB_FREQ_TOLERANCE) {
+            ib_keep_best(&r.cycles, &r.uops, cycles, uops);
+            clean++;
+
+            if (pend_ratio >= 0) {
+                ib_keep_best(&dist_cycles, &dist_uops, pend_cycles, pend_uops);
+                r.retries++;
+                pend_ratio = -1;
+            }
+        } else if (pend_ratio >= 0 && fabs(ratio - pend_ratio) <= pend_ratio * IB_FREQ_TOLERANCE) {
+            ref = ratio;
+            ib_keep_best(&r.cycles, &r.uops, pend_cycles, pend_uops);
+            ib_keep_best(&r.cycles, &r.uops, cycles, uops);
+            clean += 2;
+            pend_ratio = -1;
+        } else {
+            if (pend_ratio >= 0) {
+                ib_keep_best(&dist_cycles, &dist_uops, pend_cycles, pend_uops);
+                r.retries++;
+            }
+            pend_ratio = ratio;
+            pend_cycles = cycles;
+            pend_uops = uops;
+        }
+    }
+
+    if (pend_ratio >= 0) {
+        /* never confirmed */
+        ib_keep_best(&dist_cycles, &dist_uops, pend_cycles, pend_uops);
+    }
+
+    if (clean > 0) {
+        r.quality = (r.retries == 0) ? IB_CLEAN : IB_RETRIED;
+    } else {
+        r.quality = IB_DISTURBED;
+        r.cycles = dist_cycles;
+        r.uops = dist_uops;
+    }
+
+    r.ok = true;
+    r.cpi = r.cycles/(double)r.insns;
+    r.ipc = r.insns/(double)r.cycles;
+    if (r.uops != -1) {
+        r.upi = r.uops/(double)r.insns;
+    }
+
+    return r;
+}
+
+/* FNV-1a */
+static inline unsigned long long
+ib_hash(const void *p, size_t len, unsigned long long h = 0xcbf29ce484222325ULL)
+{
+    const unsigned char *b = (const unsigned char*)p;
+    for (size_t i=0; i<len; i++) {
+        h = (h ^ b[i]) * 0x100000001b3ULL;
+    }
+    return h;
+}
+
+/*
+ * identifies what ib_measure(f, opt) runs : the generated loop with the
+ * prologue/epilogue hooks, and the options that change the count. The
+ * prologue before the hooks (register save, zero_mem address) is left
+ * out, so the hash is stable across runs unless the kernel itself embeds
+ * an address.
+ */
+template <typename RegType, typename F>
+unsigned long long
+ib_definition_hash(F f, const ib_options &opt)
+{
+    int num_insn = opt.num_insn > 0 ? opt.num_insn : get_num_insn<RegType>();
+
+    Gen<RegType,F> g(f, opt.reserve_rcx, opt.num_loop, num_insn, opt.mode, opt.ot, opt.num_chain);
+
+    int param[] = {(int)opt.mode, (int)opt.ot, opt.num_loop, num_insn, opt.num_chain,
+                   opt.trials, (int)opt.reserve_rcx};
+
+    unsigned long long h = ib_hash(g.getCode() + g.kernel_begin, g.kernel_end - g.kernel_begin);
+    return ib_hash(param, sizeof(param), h);
+}
+
+#endif
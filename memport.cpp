@@ -0,0 +1,189 @@
+#include "common.hpp"
+
+/*
+ * load/store port throughput
+ *
+ * each block issues num_load loads and num_store stores, all to
+ * different L1 resident lines. loads hit zero_mem+64*i, stores hit
+ * zero_mem+STORE_OFFSET+64*i, which is far enough to avoid forwarding
+ * and does not 4K-alias with the loads.
+ *
+ * ops/cycle and bytes/cycle are derived from the block throughput.
+ */
+
+#define STORE_OFFSET (1024*1024 + 2048)
+
+static void
+mem_load(Xbyak::CodeGenerator *g, Xbyak::Reg64 r, int bits, int off, bool fold)
+{
+    switch (bits) {
+    case 8:
+        if (fold) {
+            g->add(r.cvt8(), g->ptr[g->rdx + off]);
+        } else {
+            g->movzx(r.cvt32(), g->byte[g->rdx + off]);
+        }
+        break;
+    case 16:
+        if (fold) {
+            g->add(r.cvt16(), g->ptr[g->rdx + off]);
+        } else {
+            g->movzx(r.cvt32(), g->word[g->rdx + off]);
+        }
+        break;
+    case 32:
+        if (fold) {
+            g->add(r.cvt32(), g->ptr[g->rdx + off]);
+        } else {
+            g->mov(r.cvt32(), g->ptr[g->rdx + off]);
+        }
+        break;
+    default:
+        if (fold) {
+            g->add(r, g->ptr[g->rdx + off]);
+        } else {
+            g->mov(r, g->ptr[g->rdx + off]);
+        }
+        break;
+    }
+}
+
+static void
+mem_store(Xbyak::CodeGenerator *g, Xbyak::Reg64 r, int bits, int off)
+{
+    switch (bits) {
+    case 8:
+        g->mov(g->ptr[g->rdx + off], r.cvt8());
+        break;
+    case 16:
+        g->mov(g->ptr[g->rdx + off], r.cvt16());
+        break;
+    case 32:
+        g->mov(g->ptr[g->rdx + off], r.cvt32());
+        break;
+    default:
+        g->mov(g->ptr[g->rdx + off], r);
+        break;
+    }
+}
+
+static void
+mem_load(Xbyak::CodeGenerator *g, Xbyak::Xmm r, int, int off, bool fold)
+{
+    if (fold) {
+        g->paddd(r, g->ptr[g->rdx + off]);
+    } else {
+        g->movdqa(r, g->ptr[g->rdx + off]);
+    }
+}
+
+static void
+mem_store(Xbyak::CodeGenerator *g, Xbyak::Xmm r, int, int off)
+{
+    g->movdqa(g->ptr[g->rdx + off], r);
+}
+
+static void
+mem_load(Xbyak::CodeGenerator *g, Xbyak::Ymm r, int, int off, bool fold)
+{
+    if (fold) {
+        g->vaddps(r, r, g->ptr[g->rdx + off]);
+    } else {
+        g->vmovdqa(r, g->ptr[g->rdx + off]);
+    }
+}
+
+static void
+mem_store(Xbyak::CodeGenerator *g, Xbyak::Ymm r, int, int off)
+{
+    g->vmovdqa(g->ptr[g->rdx + off], r);
+}
+
+static void
+mem_load(Xbyak::CodeGenerator *g, Xbyak::Zmm r, int, int off, bool fold)
+{
+    if (fold) {
+        g->vpaddd(r, r, g->ptr[g->rdx + off]);
+    } else {
+        g->vmovdqa32(r, g->ptr[g->rdx + off]);
+    }
+}
+
+static void
+mem_store(Xbyak::CodeGenerator *g, Xbyak::Zmm r, int, int off)
+{
+    g->vmovdqa32(g->ptr[g->rdx + off], r);
+}
+
+template <typename RegType>
+struct mem_block {
+    int num_load;
+    int num_store;
+    int bits;
+    bool fold;
+
+    void operator()(Xbyak::CodeGenerator *g, RegType dst, RegType src) {
+        for (int i=0; i<num_load; i++) {
+            mem_load(g, dst, bits, 64*i, fold);
+        }
+        for (int i=0; i<num_store; i++) {
+            mem_store(g, src, bits, STORE_OFFSET + 64*i);
+        }
+    }
+};
+
+struct mem_mix {
+    int num_load;
+    int num_store;
+    bool fold;
+};
+
+static const mem_mix mixes[] = {
+    {1, 0, false},
+    {0, 1, false},
+    {2, 1, false},
+    {1, 1, false},
+    {3, 2, false},
+    {1, 0, true},
+    {2, 1, true},
+};
+
+template <typename RegType>
+static void
+run_memport(int bits, enum operand_type ot)
+{
+    const char *class_name = RegMap<RegType>().name;
+    char name[128];
+
+    for (size_t i=0; i<sizeof(mixes)/sizeof(mixes[0]); i++) {
+        const mem_mix *m = &mixes[i];
+        mem_block<RegType> f = {m->num_load, m->num_store, bits, m->fold};
+
+        snprintf(name, sizeof(name), "%s x%d + store x%d (%dbit)",
+                 m->fold ? "load+op" : "load",
+                 m->num_load, m->num_store, bits);
+
+        lt_result r = lt<RegType>(name, "throughput", f, false, NUM_LOOP, LT_THROUGHPUT, ot);
+
+        int ops = m->num_load + m->num_store;
+        report_value(class_name, name, "ops/cycle", ops / r.cpi);
+        report_value(class_name, name, "bytes/cycle", ops * (bits/8) / r.cpi);
+    }
+}
+
+void test_memport()
+{
+    run_memport<Xbyak::Reg64>(8, OT_INT);
+    run_memport<Xbyak::Reg64>(16, OT_INT);
+    run_memport<Xbyak::Reg64>(32, OT_INT);
+    run_memport<Xbyak::Reg64>(64, OT_INT);
+    run_memport<Xbyak::Xmm>(128, OT_INT);
+
+    if (info.have_avx) {
+        run_memport<Xbyak::Ymm>(256, OT_FP32);
+    }
+
+    if (info.have_avx512f) {
+        run_memport<Xbyak::Zmm>(512, OT_INT);
+    }
+}
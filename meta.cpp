@@ -0,0 +1,107 @@
+#include "common.hpp"
+#include <time.h>
+
+/*
+ * run metadata, written next to the result csv as <csv>.meta :
+ *
+ *   host=build07
+ *   brand=Intel(R) Core(TM) i7-6700 CPU @ 3.40GHz
+ *   signature=0x000506e3
+ *   microcode=0xf0
+ *   kernel=6.1.0-18-amd64
+ *   date=1760870400
+ *
+ * results-db.py uses it to key imported runs. date is unix time.
+ */
+
+#ifdef __linux
+
+#include <sys/utsname.h>
+
+static void
+read_microcode(char *buf, size_t len)
+{
+    FILE *fp = fopen("/sys/devices/system/cpu/cpu0/microcode/version", "r");
+    if (fp) {
+        if (fgets(buf, len, fp)) {
+            buf[strcspn(buf, "\n")] = '\0';
+        }
+        fclose(fp);
+        return;
+    }
+
+    /* "microcode\t: 0xf0" */
+    fp = fopen("/proc/cpuinfo", "r");
+    if (fp == NULL) {
+        return;
+    }
+
+    char line[256];
+    while (fgets(line, sizeof(line), fp)) {
+        if (strncmp(line, "microcode", 9) == 0) {
+            char *v = strchr(line, ':');
+            if (v) {
+                snprintf(buf, len, "%s", v + 1 + strspn(v + 1, " \t"));
+                buf[strcspn(buf, "\n")] = '\0';
+            }
+            break;
+        }
+    }
+    fclose(fp);
+}
+
+static void
+read_host(run_meta *m)
+{
+    struct utsname u;
+
+    gethostname(m->host, sizeof(m->host));
+    m->host[sizeof(m->host)-1] = '\0';
+
+    if (uname(&u) == 0) {
+        snprintf(m->kernel, sizeof(m->kernel), "%s", u.release);
+    }
+
+    read_microcode(m->microcode, sizeof(m->microcode));
+}
+
+#else
+
+static void
+read_host(run_meta *)
+{
+}
+
+#endif
+
+void
+run_meta_init(run_meta *m, const char *brand)
+{
+    memset(m, 0, sizeof(*m));
+
+    snprintf(m->brand, sizeof(m->brand), "%s", brand + strspn(brand, " "));
+    m->signature = info.signature;
+    m->date = time(NULL);
+
+    read_host(m);
+}
+
+bool
+run_meta_write(const char *path, const run_meta *m)
+{
+    FILE *fp = fopen(path, "wb");
+    if (fp == NULL) {
+        perror(path);
+        return false;
+    }
+
+    fprintf(fp, "host=%s\n", m->host);
+    fprintf(fp, "brand=%s\n", m->brand);
+    fprintf(fp, "signature=0x%08x\n", m->signature);
+    fprintf(fp, "microcode=%s\n", m->microcode);
+    fprintf(fp, "kernel=%s\n", m->kernel);
+    fprintf(fp, "date=%lld\n", m->date);
+
+    fclose(fp);
+    return true;
+}
@@ -0,0 +1,141 @@
+#include "common.hpp"
+
+/*
+ * memory level parallelism
+ *
+ * One random cyclic permutation of all cache lines in a buffer much
+ * larger than LLC is split into N chains. Each chain starts on its own
+ * segment of the cycle, MLP_WALK lines long, and every chain count takes
+ * the segments after the ones the previous counts used, so no line is
+ * walked twice and every load misses. The N chains are interleaved in one loop body, like
+ * gen_throughput interleaves register chains, so up to N misses can be
+ * outstanding at once.
+ *
+ *   latency  : cycles per miss (cycles per step / N)
+ *   speedup  : single chain latency / latency
+ *
+ * The speedup saturates at the number of misses the core can keep in
+ * flight (line fill buffers / L2 miss queue), reported as
+ * "outstanding misses". If the speedup is still rising at
+ * CHASE_MAX_CHAIN chains, the core has more and the value is reported
+ * as a lower bound ("count >=").
+ */
+
+#ifdef __linux
+
+#include <sys/mman.h>
+
+#define MLP_SIZE (256*1024*1024)
+#define MLP_LINE 64
+#define MLP_LOOP 256
+#define MLP_UNROLL 16
+
+/* steps of one chain in chase() : warm-up run + timed run */
+#define MLP_WALK (2 * MLP_LOOP * MLP_UNROLL)
+
+/* speedup of the last chain count over the one before it that counts as still rising */
+#define MLP_RISING 1.05
+
+static void
+mlp_link(char *p, size_t num_line, const unsigned int *order)
+{
+    for (size_t i=0; i<num_line; i++) {
+        void **node = (void**)(p + (size_t)order[i] * MLP_LINE);
+        *node = p + (size_t)order[(i+1) % num_line] * MLP_LINE;
+    }
+}
+
+/*
+ * the chase doesn't modify the list. heads start at *next along the
+ * cycle, MLP_WALK apart, and *next moves past them. all chain counts
+ * take CHASE_MAX_CHAIN*(CHASE_MAX_CHAIN+1)/2 * MLP_WALK lines, well
+ * below num_line.
+ */
+static void
+mlp_heads(void **heads, int num_chain, char *p, size_t *next, const unsigned int *order)
+{
+    for (int ci=0; ci<num_chain; ci++) {
+        heads[ci] = p + (size_t)order[*next] * MLP_LINE;
+        *next += MLP_WALK;
+    }
+}
+
+void test_mlp()
+{
+    size_t num_line = MLP_SIZE / MLP_LINE;
+    void *map = mmap(NULL, MLP_SIZE, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+    if (map == MAP_FAILED) {
+        perror("mlp : mmap");
+        return;
+    }
+    /* keep page walks out of the picture */
+    madvise(map, MLP_SIZE, MADV_HUGEPAGE);
+
+    char *p = (char*)map;
+    unsigned int *order = new unsigned int[num_line];
+
+    for (size_t i=0; i<num_line; i++) {
+        order[i] = i;
+    }
+
+    unsigned long long seed = 1;
+    for (size_t i=num_line-1; i>0; i--) {
+        seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+        size_t j = (seed >> 24) % (i+1);
+        unsigned int t = order[i];
+        order[i] = order[j];
+        order[j] = t;
+    }
+
+    mlp_link(p, num_line, order);
+
+    char name[128];
+    double lat1 = 0, max_speedup = 0, prev_speedup = 0, speedup = 0;
+    size_t next = 0;
+
+    for (int num_chain=1; num_chain<=CHASE_MAX_CHAIN; num_chain++) {
+        void *heads[CHASE_MAX_CHAIN];
+        mlp_heads(heads, num_chain, p, &next, order);
+
+        double step = chase(heads, num_chain, MLP_LOOP, MLP_UNROLL);
+        double lat = step / num_chain;
+
+        if (num_chain == 1) {
+            lat1 = lat;
+        }
+
+        lt_result r;
+        r.cpi = lat;
+        r.ipc = 1.0 / lat;
+        r.upi = -1;
+
+        snprintf(name, sizeof(name), "%d chains", num_chain);
+        print_result("mlp", name, "latency", r);
+
+        prev_speedup = speedup;
+        speedup = lat1 / lat;
+        report_value("mlp", name, "speedup", speedup);
+
+        if (speedup > max_speedup) {
+            max_speedup = speedup;
+        }
+    }
+
+    if (speedup >= max_speedup && speedup > prev_speedup * MLP_RISING) {
+        /* not saturated, limited by the chain registers */
+        report_value("mlp", "outstanding misses", "count >=", max_speedup);
+    } else {
+        report_value("mlp", "outstanding misses", "count", max_speedup);
+    }
+
+    delete [] order;
+    munmap(map, MLP_SIZE);
+}
+
+#else
+
+void test_mlp()
+{
+}
+
+#endif
@@ -0,0 +1,323 @@
+#include "common.hpp"
+
+/*
+ * parallel execution of the suite table (--parallel)
+ *
+ * One forked worker per physical core (the first allowed logical cpu of
+ * each core, SMT siblings stay idle), pinned, with its own perf counters
+ * and JIT code. Workers pull suites from a shared counter. Each suite
+ * prints into its own temporary files, which are merged in table order
+ * afterwards, so the output is the same as a serial run.
+ *
+ * Sharding is per suite, not per test : the 18 suites of the table are
+ * the units of work, and the exclusive ones (LLC/DRAM bound : tlb, mlp,
+ * rob, strops, smt) run after the workers are done, alone on the first
+ * core. The speedup is bounded by the largest suite.
+ *
+ * cross check : PARALLEL_CHECK_SUITES suites are re-run alone and every
+ * latency/throughput row is compared with the parallel result.
+ * differences above PARALLEL_TOLERANCE are reported as interference.
+ * Derived rows (differences, ratios, verdicts) can sit near zero and are
+ * not compared.
+ */
+
+#ifdef __linux
+
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+#define PARALLEL_MAX_CPU 1024
+#define PARALLEL_CHECK_SUITES 2
+#define PARALLEL_TOLERANCE 0.05
+
+static int
+read_topology_int(int cpu, const char *name)
+{
+    char path[256];
+    snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/topology/%s", cpu, name);
+
+    FILE *fp = fopen(path, "r");
+    if (fp == NULL) {
+        return -1;
+    }
+
+    int v = -1;
+    if (fscanf(fp, "%d", &v) != 1) {
+        v = -1;
+    }
+    fclose(fp);
+    return v;
+}
+
+/* first allowed logical cpu of each (package, core) */
+static int
+physical_cores(int *cpus, int max)
+{
+    cpu_set_t set;
+    static int pkg[PARALLEL_MAX_CPU], core[PARALLEL_MAX_CPU];
+    int n = 0;
+
+    if (sched_getaffinity(0, sizeof(set), &set) != 0) {
+        return 0;
+    }
+
+    for (int cpu=0; cpu<CPU_SETSIZE && n<max; cpu++) {
+        if (!CPU_ISSET(cpu, &set)) {
+            continue;
+        }
+
+        int p = read_topology_int(cpu, "physical_package_id");
+        int c = read_topology_int(cpu, "core_id");
+        bool seen = false;
+
+        for (int i=0; i<n; i++) {
+            if (c != -1 && pkg[i] == p && core[i] == c) {
+                seen = true;
+                break;
+            }
+        }
+
+        if (!seen) {
+            pkg[n] = p;
+            core[n] = c;
+            cpus[n++] = cpu;
+        }
+    }
+
+    return n;
+}
+
+static void
+pin_cpu(int cpu)
+{
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+
+    if (sched_setaffinity(0, sizeof(set), &set) != 0) {
+        perror("sched_setaffinity");
+    }
+}
+
+/* runs s->run() with stdout and logs redirected to out/log */
+static void
+run_captured(const suite *s, FILE *out, FILE *log)
+{
+    fflush(stdout);
+    int saved_stdout = dup(1);
+    dup2(fileno(out), 1);
+
+    FILE *saved_logs = logs;
+    logs = log;
+
+    s->run();
+
+    fflush(stdout);
+    fflush(logs);
+    logs = saved_logs;
+
+    dup2(saved_stdout, 1);
+    close(saved_stdout);
+}
+
+static void
+copy_file(FILE *from, FILE *to)
+{
+    char buf[4096];
+    size_t sz;
+
+    fflush(from);
+    fseek(from, 0, SEEK_SET);
+    while ((sz = fread(buf, 1, sizeof(buf), from)) > 0) {
+        fwrite(buf, 1, sz, to);
+    }
+}
+
+static bool
+parse_row(const char *line, char *key, size_t key_len, double *cpi)
+{
+    char c[128], i[256], lt[64];
+
+    if (sscanf(line, "\"%127[^\"]\",\"%255[^\"]\",\"%63[^\"]\",\"%lf\"", c, i, lt, cpi) != 4) {
+        return false;
+    }
+
+    /* only measured rows, derived values can be near zero */
+    if (strcmp(lt, "latency") != 0 && strcmp(lt, "throughput") != 0) {
+        return false;
+    }
+
+    snprintf(key, key_len, "%s/%s/%s", c, i, lt);
+    return true;
+}
+
+/* compares rows of two logs of the same suite, in order */
+static void
+cross_check(const suite *s, FILE *par, FILE *solo)
+{
+    char l0[1024], l1[1024], k0[512], k1[512];
+    double v0, v1, max_diff = 0;
+
+    fflush(par);
+    fflush(solo);
+    fseek(par, 0, SEEK_SET);
+    fseek(solo, 0, SEEK_SET);
+
+    while (fgets(l0, sizeof(l0), par) && fgets(l1, sizeof(l1), solo)) {
+        if (!parse_row(l0, k0, sizeof(k0), &v0) ||
+            !parse_row(l1, k1, sizeof(k1), &v1) ||
+            strcmp(k0, k1) != 0 ||
+            v1 == 0)
+        {
+            continue;
+        }
+
+        double diff = fabs(v0 - v1) / fabs(v1);
+        if (diff > max_diff) {
+            max_diff = diff;
+        }
+
+        if (diff > PARALLEL_TOLERANCE) {
+            report_value("parallel", k0, "interference", diff);
+        }
+    }
+
+    report_value("parallel", s->name, "max diff", max_diff);
+}
+
+void
+run_parallel(const suite *suites, int num_suite, void (*worker_init)(void))
+{
+    static int cpus[PARALLEL_MAX_CPU];
+    int num_cpu = physical_cores(cpus, PARALLEL_MAX_CPU);
+
+    if (num_cpu <= 1) {
+        fprintf(stderr, "parallel : only one core available, running serially\n");
+        for (int i=0; i<num_suite; i++) {
+            suites[i].run();
+        }
+        return;
+    }
+
+    FILE **out = new FILE*[num_suite];
+    FILE **log = new FILE*[num_suite];
+    for (int i=0; i<num_suite; i++) {
+        out[i] = tmpfile();
+        log[i] = tmpfile();
+        if (out[i] == NULL || log[i] == NULL) {
+            perror("tmpfile");
+            exit(1);
+        }
+    }
+
+    int *next = (int*)mmap(NULL, sizeof(int), PROT_READ|PROT_WRITE, MAP_SHARED|MAP_ANONYMOUS, -1, 0);
+    if (next == MAP_FAILED) {
+        perror("mmap");
+        exit(1);
+    }
+    *next = 0;
+
+    fflush(stdout);
+    fflush(logs);
+
+    pid_t *workers = new pid_t[num_cpu];
+    for (int w=0; w<num_cpu; w++) {
+        workers[w] = fork();
+        if (workers[w] == -1) {
+            perror("fork");
+            exit(1);
+        }
+
+        if (workers[w] == 0) {
+            /* workers would truncate each other's out.bin */
+            static char worker_dump[64];
+            snprintf(worker_dump, sizeof(worker_dump), "out.%d.bin", (int)getpid());
+            dump_path = worker_dump;
+
+            pin_cpu(cpus[w]);
+            worker_init();
+
+            while (1) {
+                int i = __sync_fetch_and_add(next, 1);
+                if (i >= num_suite) {
+                    break;
+                }
+                if (!suites[i].exclusive) {
+                    run_captured(&suites[i], out[i], log[i]);
+                }
+            }
+            _exit(0);
+        }
+    }
+
+    for (int w=0; w<num_cpu; w++) {
+        int status;
+        waitpid(workers[w], &status, 0);
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+            fprintf(stderr, "parallel : worker on cpu %d failed\n", cpus[w]);
+            exit(1);
+        }
+    }
+
+    pin_cpu(cpus[0]);
+    worker_init();
+
+    for (int i=0; i<num_suite; i++) {
+        if (suites[i].exclusive) {
+            run_captured(&suites[i], out[i], log[i]);
+        }
+    }
+
+    for (int i=0; i<num_suite; i++) {
+        copy_file(out[i], stdout);
+        copy_file(log[i], logs);
+    }
+    fflush(stdout);
+
+    for (int ci=0; ci<PARALLEL_CHECK_SUITES; ci++) {
+        int i = ci * num_suite / PARALLEL_CHECK_SUITES;
+        while (i < num_suite && suites[i].exclusive) {
+            i++;
+        }
+        if (i >= num_suite) {
+            continue;
+        }
+
+        FILE *solo_out = tmpfile();
+        FILE *solo_log = tmpfile();
+        if (solo_out == NULL || solo_log == NULL) {
+            perror("tmpfile");
+            exit(1);
+        }
+
+        run_captured(&suites[i], solo_out, solo_log);
+        cross_check(&suites[i], log[i], solo_log);
+
+        fclose(solo_out);
+        fclose(solo_log);
+    }
+
+    for (int i=0; i<num_suite; i++) {
+        fclose(out[i]);
+        fclose(log[i]);
+    }
+
+    munmap(next, sizeof(int));
+    delete [] workers;
+    delete [] out;
+    delete [] log;
+}
+
+#else
+
+void
+run_parallel(const suite *suites, int num_suite, void (*)(void))
+{
+    fprintf(stderr, "parallel : not supported on this platform, running serially\n");
+    for (int i=0; i<num_suite; i++) {
+        suites[i].run();
+    }
+}
+
+#endif
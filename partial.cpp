@@ -0,0 +1,115 @@
+#include "common.hpp"
+
+/*
+ * partial register / partial flags merge and carry chains
+ *
+ * write->read pairs are measured as latency and throughput chains, then
+ * compared with the same chain written at full width. "penalty" and
+ * "throughput penalty" are the extra cycles per pair.
+ */
+
+/* alternates adcx/adox so that CF and OF carry two independent chains */
+struct adcx_adox {
+    int n;
+
+    void operator()(Xbyak::CodeGenerator *g, Xbyak::Reg64 dst, Xbyak::Reg64 src) {
+        if (n++ & 1) {
+            g->adox(dst, src);
+        } else {
+            g->adcx(dst, src);
+        }
+    }
+};
+
+/* latency and throughput of the same chain */
+struct lt_both {
+    lt_result lat, tp;
+};
+
+#define PARTIAL(name, expr)                                                    \
+    lt_both{GEN_lt(Reg64, name, "latency", expr, LT_LATENCY, OT_INT),          \
+            GEN_lt(Reg64, name, "throughput", expr, LT_THROUGHPUT, OT_INT)}
+
+static void
+penalty(const char *name, const lt_both &partial, const lt_both &base)
+{
+    report_value("reg64", name, "penalty", partial.lat.cpi - base.lat.cpi);
+    report_value("reg64", name, "throughput penalty", partial.tp.cpi - base.tp.cpi);
+}
+
+static void
+penalty_latency(const char *name, lt_result partial, lt_result base)
+{
+    report_value("reg64", name, "penalty", partial.cpi - base.cpi);
+}
+
+void test_partial()
+{
+    /* partial register write, full register read */
+    lt_both full = PARTIAL("add r32 -> add r64", (g->add(dst.cvt32(), 1)); (g->add(dst, src)));
+
+    lt_both r16 = PARTIAL("add r16 -> add r64", (g->add(dst.cvt16(), 1)); (g->add(dst, src)));
+    penalty("add r16 -> add r64", r16, full);
+
+    lt_both low8 = PARTIAL("add low8 -> add r64", (g->add(dst.cvt8(), 1)); (g->add(dst, src)));
+    penalty("add low8 -> add r64", low8, full);
+
+    /* write only : r32 write breaks the chain, low8 write has to merge */
+    lt_both mov32 = PARTIAL("mov r32,imm -> add r64", (g->mov(dst.cvt32(), 1)); (g->add(dst, src)));
+    lt_both mov8 = PARTIAL("mov low8,imm -> add r64", (g->mov(dst.cvt8(), 1)); (g->add(dst, src)));
+    penalty("mov low8,imm -> add r64", mov8, mov32);
+
+    /*
+     * high8. only rax..rbx have them, so every throughput chain would be
+     * the same register : these are latency only.
+     */
+    lt_result eax = GEN_lt(Reg64, "add eax -> add rax", "latency",
+                           (g->add(g->eax, 1)); (g->add(g->rax, g->rax)),
+                           LT_LATENCY, OT_INT);
+    lt_result al = GEN_lt(Reg64, "add al -> add rax", "latency",
+                          (g->add(g->al, 1)); (g->add(g->rax, g->rax)),
+                          LT_LATENCY, OT_INT);
+    penalty_latency("add al -> add rax", al, eax);
+    lt_result ah = GEN_lt(Reg64, "add ah -> add rax", "latency",
+                          (g->add(g->ah, 1)); (g->add(g->rax, g->rax)),
+                          LT_LATENCY, OT_INT);
+    penalty_latency("add ah -> add rax", ah, eax);
+    GEN_lt(Reg64, "add ah -> add al", "latency",
+           (g->add(g->ah, 1)); (g->add(g->al, g->al)),
+           LT_LATENCY, OT_INT);
+
+    /*
+     * partial flags : inc/dec leave CF untouched. throughput chains share
+     * the flags, only the register dependency is broken.
+     */
+    lt_both add_adc = PARTIAL("add -> adc", (g->add(dst, 1)); (g->adc(dst, src)));
+    lt_both inc_adc = PARTIAL("inc -> adc", (g->inc(dst)); (g->adc(dst, src)));
+    penalty("inc -> adc", inc_adc, add_adc);
+
+    lt_both sub_cmovc = PARTIAL("sub -> cmovc", (g->sub(dst, 1)); (g->cmovc(dst, src)));
+    lt_both dec_cmovc = PARTIAL("dec -> cmovc", (g->dec(dst)); (g->cmovc(dst, src)));
+    penalty("dec -> cmovc", dec_cmovc, sub_cmovc);
+
+    lt_both add_cmovbe = PARTIAL("add -> cmovbe", (g->add(dst, 1)); (g->cmovbe(dst, src)));
+    lt_both inc_cmovbe = PARTIAL("inc -> cmovbe", (g->inc(dst)); (g->cmovbe(dst, src)));
+    penalty("inc -> cmovbe", inc_cmovbe, add_cmovbe);
+
+    /*
+     * carry chains.
+     * throughput variants use independent registers, so only the flag
+     * dependency remains.
+     */
+    GEN(Reg64, "adc", (g->adc(dst, src)), false, OT_INT);
+    GEN(Reg64, "sbb", (g->sbb(dst, src)), false, OT_INT);
+    GEN(Reg64, "adc r,imm", (g->adc(dst, 1)), false, OT_INT);
+    GEN_throughput_only(Reg64, "adc [mem]", (g->adc(dst, g->ptr[g->rdx])), false, OT_INT);
+    GEN_throughput_only(Reg64, "clc + adc", (g->clc()); (g->adc(dst, src)), false, OT_INT);
+
+    if (info.have_adx) {
+        GEN(Reg64, "adcx", (g->adcx(dst, src)), false, OT_INT);
+        GEN(Reg64, "adox", (g->adox(dst, src)), false, OT_INT);
+
+        adcx_adox f = {0};
+        lt<Xbyak::Reg64>("adcx/adox interleave", "throughput", f, false, NUM_LOOP, LT_THROUGHPUT, OT_INT);
+    }
+}
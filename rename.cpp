@@ -0,0 +1,258 @@
+#include "common.hpp"
+
+/*
+ * zero idiom / move elimination / dependency breaking
+ *
+ * For each candidate idiom three things are measured in LT_LATENCY mode
+ * (only v8 is used by Gen, so v9..v15 are free here):
+ *
+ *  chain : idiom repeated on one register (copies ping-pong v8 <-> v9)
+ *  dep   : producer v8 ; idiom v8
+ *          if the idiom breaks the dependency, the producer latency disappears
+ *  port  : N independent 1-cycle ALU chains + idiom, compared against
+ *          N chains + nop (needs no port) and N+1 chains (needs a port)
+ *
+ * result row : "<idiom> : <verdict>", metric "idiom"
+ *  eliminated   : no latency, and does not take an execution port
+ *  dep-breaking : does not depend on its input, but executes on a port
+ *  unknown      : no latency, but port usage could not be determined on
+ *                 this CPU (the probe block is rename bound)
+ *  executed     : normal instruction with input dependency
+ *
+ * the value is the latency added to the chain in cycles
+ */
+
+template <typename RegType>
+struct idiom {
+    const char *name;
+    void (*emit)(Xbyak::CodeGenerator *g, RegType dst, RegType src);
+    bool copy;
+};
+
+template <typename RegType>
+struct idiom_class {
+    const char *producer_name;
+    void (*producer)(Xbyak::CodeGenerator *g, RegType r);
+    void (*alu)(Xbyak::CodeGenerator *g, RegType r);
+    int num_alu;
+};
+
+template <typename RegType>
+struct idiom_producer {
+    const idiom_class<RegType> *cls;
+
+    void operator()(Xbyak::CodeGenerator *g, RegType dst, RegType) {
+        cls->producer(g, dst);
+    }
+};
+
+template <typename RegType>
+struct idiom_chain {
+    const idiom<RegType> *id;
+    const idiom_class<RegType> *cls;
+    bool with_producer;
+
+    void operator()(Xbyak::CodeGenerator *g, RegType dst, RegType) {
+        RegType tmp(9);
+        if (with_producer) {
+            cls->producer(g, dst);
+        }
+        if (id->copy) {
+            id->emit(g, tmp, dst);
+            id->emit(g, dst, tmp);
+        } else {
+            id->emit(g, dst, dst);
+        }
+    }
+};
+
+enum port_probe_op {
+    PROBE_IDIOM,
+    PROBE_NOP,
+    PROBE_ALU
+};
+
+template <typename RegType>
+struct idiom_port_probe {
+    const idiom<RegType> *id;
+    const idiom_class<RegType> *cls;
+    enum port_probe_op op;
+
+    void operator()(Xbyak::CodeGenerator *g, RegType dst, RegType) {
+        for (int i=0; i<cls->num_alu; i++) {
+            cls->alu(g, RegType(10+i));
+        }
+
+        switch (op) {
+        case PROBE_IDIOM:
+            if (id->copy) {
+                id->emit(g, dst, RegType(9));
+            } else {
+                id->emit(g, dst, dst);
+            }
+            break;
+        case PROBE_NOP:
+            g->nop();
+            break;
+        case PROBE_ALU:
+            cls->alu(g, RegType(10+cls->num_alu));
+            break;
+        }
+    }
+};
+
+template <typename RegType>
+static void
+run_idioms(const idiom_class<RegType> &cls,
+           const idiom<RegType> *ids, int num_ids,
+           enum operand_type ot)
+{
+    const char *class_name = RegMap<RegType>().name;
+    char name[128];
+
+    idiom_producer<RegType> prod = {&cls};
+    double prod_lat = lt<RegType>(cls.producer_name, "latency", prod, false, NUM_LOOP, LT_LATENCY, ot).cpi;
+
+    idiom_port_probe<RegType> probe_nop = {0, &cls, PROBE_NOP};
+    idiom_port_probe<RegType> probe_alu = {0, &cls, PROBE_ALU};
+    snprintf(name, sizeof(name), "%dx alu + nop", cls.num_alu);
+    double nop_cpi = lt<RegType>(name, "latency", probe_nop, false, NUM_LOOP, LT_LATENCY, ot).cpi;
+    snprintf(name, sizeof(name), "%dx alu + alu", cls.num_alu);
+    double alu_cpi = lt<RegType>(name, "latency", probe_alu, false, NUM_LOOP, LT_LATENCY, ot).cpi;
+
+    /* nop and alu are indistinguishable when the block is rename bound */
+    bool port_known = (alu_cpi - nop_cpi) > 0.1;
+
+    for (int i=0; i<num_ids; i++) {
+        const idiom<RegType> *id = &ids[i];
+        idiom_chain<RegType> chain = {id, &cls, false};
+        idiom_chain<RegType> dep = {id, &cls, true};
+        idiom_port_probe<RegType> probe = {id, &cls, PROBE_IDIOM};
+
+        double chain_cpi = lt<RegType>(id->name, "latency", chain, false, NUM_LOOP, LT_LATENCY, ot).cpi;
+
+        snprintf(name, sizeof(name), "%s->%s", cls.producer_name, id->name);
+        double dep_cpi = lt<RegType>(name, "latency", dep, false, NUM_LOOP, LT_LATENCY, ot).cpi;
+
+        snprintf(name, sizeof(name), "%dx alu + %s", cls.num_alu, id->name);
+        double probe_cpi = lt<RegType>(name, "latency", probe, false, NUM_LOOP, LT_LATENCY, ot).cpi;
+
+        bool uses_port = (probe_cpi - nop_cpi) > (alu_cpi - probe_cpi);
+        const char *verdict;
+        double evidence;
+
+        if (id->copy) {
+            /* two copies per chain step */
+            evidence = chain_cpi / 2;
+            if (evidence >= 0.5 || (port_known && uses_port)) {
+                verdict = "executed";
+            } else if (!port_known) {
+                verdict = "unknown";
+            } else {
+                verdict = "eliminated";
+            }
+        } else {
+            evidence = dep_cpi - prod_lat;
+            if (evidence < 0) {
+                evidence = 0;
+            }
+
+            if (dep_cpi > prod_lat - 0.5) {
+                verdict = "executed";
+            } else if (!port_known) {
+                verdict = "unknown";
+            } else if (!uses_port) {
+                verdict = "eliminated";
+            } else {
+                verdict = "dep-breaking";
+            }
+        }
+
+        snprintf(name, sizeof(name), "%s : %s", id->name, verdict);
+        report_value(class_name, name, "idiom", evidence);
+    }
+}
+
+#define IDIOM(rt, name, expr, copy) \
+    { name, [](Xbyak::CodeGenerator *g, Xbyak::rt dst, Xbyak::rt src){expr;}, copy }
+
+void test_rename()
+{
+    using namespace Xbyak;
+
+    {
+        static const idiom_class<Reg64> cls = {
+            "imul",
+            [](CodeGenerator *g, Reg64 r){g->imul(r, r);},
+            [](CodeGenerator *g, Reg64 r){g->add(r, r);},
+            4
+        };
+        static const idiom<Reg64> ids[] = {
+            IDIOM(Reg64, "xor r64,r64", (g->xor_(dst, src)), false),
+            IDIOM(Reg64, "xor r32,r32", (g->xor_(dst.cvt32(), src.cvt32())), false),
+            IDIOM(Reg64, "sub r64,r64", (g->sub(dst, src)), false),
+            IDIOM(Reg64, "mov r64,r64", (g->mov(dst, src)), true),
+            IDIOM(Reg64, "mov r32,r32", (g->mov(dst.cvt32(), src.cvt32())), true),
+            IDIOM(Reg64, "movzx r32,r8", (g->movzx(dst.cvt32(), src.cvt8())), true),
+        };
+        run_idioms<Reg64>(cls, ids, sizeof(ids)/sizeof(ids[0]), OT_INT);
+    }
+
+    {
+        static const idiom_class<Xmm> cls = {
+            "pmuludq",
+            [](CodeGenerator *g, Xmm r){g->pmuludq(r, r);},
+            [](CodeGenerator *g, Xmm r){g->paddd(r, r);},
+            3
+        };
+        static const idiom<Xmm> ids[] = {
+            IDIOM(Xmm, "pxor x,x", (g->pxor(dst, src)), false),
+            IDIOM(Xmm, "xorps x,x", (g->xorps(dst, src)), false),
+            IDIOM(Xmm, "xorpd x,x", (g->xorpd(dst, src)), false),
+            IDIOM(Xmm, "psubd x,x", (g->psubd(dst, src)), false),
+            IDIOM(Xmm, "pcmpgtd x,x", (g->pcmpgtd(dst, src)), false),
+            IDIOM(Xmm, "pcmpeqd x,x", (g->pcmpeqd(dst, src)), false),
+            IDIOM(Xmm, "movaps x,x", (g->movaps(dst, src)), true),
+            IDIOM(Xmm, "movdqa x,x", (g->movdqa(dst, src)), true),
+            IDIOM(Xmm, "movapd x,x", (g->movapd(dst, src)), true),
+        };
+        run_idioms<Xmm>(cls, ids, sizeof(ids)/sizeof(ids[0]), OT_INT);
+    }
+
+    if (info.have_avx2) {
+        static const idiom_class<Ymm> cls = {
+            "vpmuludq",
+            [](CodeGenerator *g, Ymm r){g->vpmuludq(r, r, r);},
+            [](CodeGenerator *g, Ymm r){g->vpaddd(r, r, r);},
+            3
+        };
+        static const idiom<Ymm> ids[] = {
+            IDIOM(Ymm, "vpxor y,y,y", (g->vpxor(dst, src, src)), false),
+            IDIOM(Ymm, "vxorps y,y,y", (g->vxorps(dst, src, src)), false),
+            IDIOM(Ymm, "vpsubd y,y,y", (g->vpsubd(dst, src, src)), false),
+            IDIOM(Ymm, "vpcmpgtd y,y,y", (g->vpcmpgtd(dst, src, src)), false),
+            IDIOM(Ymm, "vpcmpeqd y,y,y", (g->vpcmpeqd(dst, src, src)), false),
+            IDIOM(Ymm, "vmovaps y,y", (g->vmovaps(dst, src)), true),
+            IDIOM(Ymm, "vmovdqa y,y", (g->vmovdqa(dst, src)), true),
+        };
+        run_idioms<Ymm>(cls, ids, sizeof(ids)/sizeof(ids[0]), OT_INT);
+    }
+
+    if (info.have_avx512f) {
+        static const idiom_class<Zmm> cls = {
+            "vpmuludq",
+            [](CodeGenerator *g, Zmm r){g->vpmuludq(r, r, r);},
+            [](CodeGenerator *g, Zmm r){g->vpaddd(r, r, r);},
+            2
+        };
+        static const idiom<Zmm> ids[] = {
+            IDIOM(Zmm, "vpxord z,z,z", (g->vpxord(dst, src, src)), false),
+            IDIOM(Zmm, "vpxorq z,z,z", (g->vpxorq(dst, src, src)), false),
+            IDIOM(Zmm, "vpsubd z,z,z", (g->vpsubd(dst, src, src)), false),
+            IDIOM(Zmm, "vpternlogd z,z,z,0xff", (g->vpternlogd(dst, src, src, 0xff)), false),
+            IDIOM(Zmm, "vmovaps z,z", (g->vmovaps(dst, src)), true),
+            IDIOM(Zmm, "vmovdqa64 z,z", (g->vmovdqa64(dst, src)), true),
+        };
+        run_idioms<Zmm>(cls, ids, sizeof(ids)/sizeof(ids[0]), OT_INT);
+    }
+}
@@ -0,0 +1,379 @@
+#!/usr/bin/python3
+
+# results store for bench csv files
+#
+#   results-db.py [-d db] import <csv>...
+#   results-db.py [-d db] runs
+#   results-db.py [-d db] fastest <inst> [l/t] [class]
+#   results-db.py [-d db] trend <host|signature> <class> <inst> [l/t]
+#   results-db.py [-d db] pivot <class> [l/t]
+#
+# db (default logs/results.ibdb) is an append only file of records :
+#
+#   header : "IBDB" u32 version
+#   record : u8 type, u16 length, payload
+#     string : u32 id, utf-8
+#     run    : u32 id, host, brand, u32 signature, microcode, kernel, i64 date, source, digest
+#     row    : u32 run, class, inst, l/t, f64 cpi, f64 ipc, quality
+#
+# (host, brand, class, ... are string ids.) The file is mmaped and indexed
+# by host, signature, date and (class, inst, l/t) when opened.
+#
+# <csv>.meta written by bench gives host, signature, microcode, kernel and
+# date. csv files without it (older logs/linux/*.csv) are imported with the
+# file name as host and the file mtime as date, and are recognized as
+# already imported by host and digest (sha1 of the csv), since a checkout
+# changes the mtime.
+
+import struct
+
+MAGIC = b'IBDB'
+VERSION = 1
+
+REC_STRING = 1
+REC_RUN = 2
+REC_ROW = 3
+
+REC_HEADER = struct.Struct('<BH')
+RUN = struct.Struct('<IIIIIIqII')
+ROW = struct.Struct('<IIIIddI')
+
+def usage():
+    import sys
+    print("usage : results-db.py [-d db] import <csv>...")
+    print("        results-db.py [-d db] runs")
+    print("        results-db.py [-d db] fastest <inst> [l/t] [class]")
+    print("        results-db.py [-d db] trend <host|signature> <class> <inst> [l/t]")
+    print("        results-db.py [-d db] pivot <class> [l/t]")
+    sys.exit(1)
+
+class Run:
+    def __init__(self, id, host, brand, signature, microcode, kernel, date, source, digest):
+        self.id = id
+        self.host = host
+        self.brand = brand
+        self.signature = signature
+        self.microcode = microcode
+        self.kernel = kernel
+        self.date = date
+        self.source = source
+        self.digest = digest
+
+class Row:
+    def __init__(self, run, clas, inst, lt, cpi, ipc, quality):
+        self.run = run
+        self.clas = clas
+        self.inst = inst
+        self.lt = lt
+        self.cpi = cpi
+        self.ipc = ipc
+        self.quality = quality
+
+class Store:
+    def __init__(self, path):
+        self.path = path
+        self.strings = []
+        self.string_id = {}
+        self.runs = {}
+        self.rows = []
+
+        self.by_host = {}
+        self.by_signature = {}
+        self.by_key = {}
+
+        self.load()
+
+    def load(self):
+        import mmap
+        import os
+
+        if not os.path.exists(self.path) or os.path.getsize(self.path) == 0:
+            return
+
+        with open(self.path, 'rb') as f:
+            m = mmap.mmap(f.fileno(), 0, access=mmap.ACCESS_READ)
+
+            if m[0:4] != MAGIC:
+                raise SystemExit("%s : not a results db"%(self.path))
+
+            off = 8
+            while off + REC_HEADER.size <= len(m):
+                t, length = REC_HEADER.unpack_from(m, off)
+                off += REC_HEADER.size
+                payload = m[off:off+length]
+                off += length
+
+                if t == REC_STRING:
+                    (id,) = struct.unpack_from('<I', payload)
+                    self.add_string(payload[4:].decode('utf-8'), id)
+                elif t == REC_RUN:
+                    self.add_run(RUN.unpack(payload))
+                elif t == REC_ROW:
+                    self.add_row(ROW.unpack(payload))
+
+            m.close()
+
+    def add_string(self, s, id):
+        while len(self.strings) <= id:
+            self.strings.append(None)
+        self.strings[id] = s
+        self.string_id[s] = id
+
+    def add_run(self, v):
+        s = self.strings
+        r = Run(v[0], s[v[1]], s[v[2]], v[3], s[v[4]], s[v[5]], v[6], s[v[7]], s[v[8]])
+        self.runs[r.id] = r
+        self.by_host.setdefault(r.host, []).append(r)
+        self.by_signature.setdefault(r.signature, []).append(r)
+
+    def add_row(self, v):
+        s = self.strings
+        row = Row(self.runs[v[0]], s[v[1]], s[v[2]], s[v[3]], v[4], v[5], s[v[6]])
+        self.rows.append(row)
+        self.by_key.setdefault((row.clas, row.inst, row.lt), []).append(row)
+
+    # appending
+
+    def intern(self, f, s):
+        if s in self.string_id:
+            return self.string_id[s]
+
+        id = len(self.strings)
+        data = struct.pack('<I', id) + s.encode('utf-8')
+        f.write(REC_HEADER.pack(REC_STRING, len(data)) + data)
+        self.add_string(s, id)
+        return id
+
+    def find_run(self, host, signature, microcode, date):
+        for r in self.by_host.get(host, []):
+            if r.signature == signature and r.microcode == microcode and r.date == date:
+                return r
+        return None
+
+    def find_digest(self, host, digest):
+        for r in self.by_host.get(host, []):
+            if r.digest == digest:
+                return r
+        return None
+
+    def append(self, meta, rows, source):
+        import os
+
+        new = not os.path.exists(self.path) or os.path.getsize(self.path) == 0
+
+        with open(self.path, 'ab') as f:
+            if new:
+                f.write(MAGIC + struct.pack('<I', VERSION))
+
+            run_id = len(self.runs)
+            v = (run_id,
+                 self.intern(f, meta['host']),
+                 self.intern(f, meta['brand']),
+                 meta['signature'],
+                 self.intern(f, meta['microcode']),
+                 self.intern(f, meta['kernel']),
+                 meta['date'],
+                 self.intern(f, source),
+                 self.intern(f, meta['digest']))
+            f.write(REC_HEADER.pack(REC_RUN, RUN.size) + RUN.pack(*v))
+            self.add_run(v)
+
+            for row in rows:
+                v = (run_id,
+                     self.intern(f, row['class']),
+                     self.intern(f, row['inst']),
+                     self.intern(f, row['l/t']),
+                     row['cpi'],
+                     row['ipc'],
+                     self.intern(f, row['quality']))
+                f.write(REC_HEADER.pack(REC_ROW, ROW.size) + ROW.pack(*v))
+                self.add_row(v)
+
+    # queries
+
+    def latest_runs(self):
+        latest = {}
+        for host, runs in self.by_host.items():
+            latest[host] = max(runs, key=lambda r: r.date)
+        return latest
+
+def to_float(s):
+    try:
+        return float(s)
+    except (TypeError, ValueError):
+        return float('nan')
+
+def load_meta(csv_path):
+    import hashlib
+    import os
+
+    host = os.path.basename(csv_path)
+    if host.endswith('.csv'):
+        host = host[:-4]
+
+    with open(csv_path, 'rb') as f:
+        digest = hashlib.sha1(f.read()).hexdigest()
+
+    meta = {'host': host,
+            'brand': host,
+            'signature': 0,
+            'microcode': '',
+            'kernel': '',
+            'date': int(os.path.getmtime(csv_path)),
+            'digest': digest,
+            'has_meta': False}
+
+    if os.path.exists(csv_path + '.meta'):
+        meta['has_meta'] = True
+        with open(csv_path + '.meta', 'r') as f:
+            for line in f:
+                if '=' not in line:
+                    continue
+                k, v = line.rstrip('\n').split('=', 1)
+                if k == 'signature':
+                    meta[k] = int(v, 16)
+                elif k == 'date':
+                    meta[k] = int(v)
+                elif k in meta:
+                    meta[k] = v
+
+    return meta
+
+def cmd_import(db, paths):
+    import csv
+
+    for path in paths:
+        meta = load_meta(path)
+
+        if meta['has_meta']:
+            found = db.find_run(meta['host'], meta['signature'], meta['microcode'], meta['date'])
+        else:
+            found = db.find_digest(meta['host'], meta['digest'])
+
+        if found:
+            print("%s : already imported"%(path))
+            continue
+
+        rows = []
+        with open(path, 'r') as f:
+            for row in csv.DictReader(f):
+                rows.append({'class': row['class'],
+                             'inst': row['inst'],
+                             'l/t': row['l/t'],
+                             'cpi': to_float(row['cpi']),
+                             'ipc': to_float(row.get('ipc')),
+                             'quality': row.get('quality') or ''})
+
+        db.append(meta, rows, path)
+        print("%s : %d rows (%s)"%(path, len(rows), meta['host']))
+
+def format_date(t):
+    import time
+    return time.strftime('%Y-%m-%d', time.gmtime(t))
+
+def cmd_runs(db):
+    print("%4s %-40s %10s %10s %10s %6s"%('run', 'host', 'signature', 'microcode', 'date', 'rows'))
+
+    count = {}
+    for row in db.rows:
+        count[row.run.id] = count.get(row.run.id, 0) + 1
+
+    for id in sorted(db.runs):
+        r = db.runs[id]
+        print("%4d %-40s 0x%08x %10s %10s %6d"%
+              (r.id, r.host[:40], r.signature, r.microcode or '-', format_date(r.date), count.get(id, 0)))
+
+def cmd_fastest(db, inst, lt, clas):
+    latest = db.latest_runs()
+    found = []
+
+    for key, rows in db.by_key.items():
+        if key[1] != inst or key[2] != lt or (clas and key[0] != clas):
+            continue
+        for row in rows:
+            if latest[row.run.host] is row.run:
+                found.append(row)
+
+    found.sort(key=lambda row: row.cpi)
+
+    print("%8s %-40s %10s %10s %s"%('class', 'host', 'CPI', 'IPC', 'quality'))
+    for row in found:
+        print("%8s %-40s %10.2f %10.2f %s"%(row.clas, row.run.host[:40], row.cpi, row.ipc, row.quality))
+
+def cmd_trend(db, host, clas, inst, lt):
+    if host.startswith('0x'):
+        runs = db.by_signature.get(int(host, 16), [])
+    else:
+        runs = db.by_host.get(host, [])
+
+    ids = set(r.id for r in runs)
+    rows = [row for row in db.by_key.get((clas, inst, lt), []) if row.run.id in ids]
+    rows.sort(key=lambda row: row.run.date)
+
+    print("%10s %10s %-24s %10s %8s"%('date', 'microcode', 'kernel', 'CPI', 'rel[%]'))
+    base = None
+    for row in rows:
+        if base is None:
+            base = row.cpi
+        rel = (row.cpi / base - 1) * 100 if base else float('nan')
+        print("%10s %10s %-24s %10.2f %8.1f"%
+              (format_date(row.run.date), row.run.microcode or '-', row.run.kernel[:24] or '-',
+               row.cpi, rel))
+
+def cmd_pivot(db, clas, lt):
+    latest = db.latest_runs()
+    hosts = sorted(latest)
+
+    insts = sorted(set(key[1] for key in db.by_key if key[0] == clas and key[2] == lt))
+
+    print("%32s | %s"%('instruction', ' '.join("%12s"%(h[:12]) for h in hosts)))
+    for inst in insts:
+        cpi = {}
+        for row in db.by_key[(clas, inst, lt)]:
+            if latest[row.run.host] is row.run:
+                cpi[row.run.host] = row.cpi
+
+        cols = []
+        for h in hosts:
+            if h in cpi:
+                cols.append("%12.2f"%(cpi[h]))
+            else:
+                cols.append("%12s"%('N/A'))
+        print("%32s | %s"%(inst[:32], ' '.join(cols)))
+
+def main():
+    import sys
+
+    args = sys.argv[1:]
+    path = 'logs/results.ibdb'
+    if len(args) >= 2 and args[0] == '-d':
+        path = args[1]
+        args = args[2:]
+
+    if len(args) < 1:
+        usage()
+
+    db = Store(path)
+    cmd = args[0]
+    args = args[1:]
+
+    if cmd == 'import' and len(args) >= 1:
+        cmd_import(db, args)
+    elif cmd == 'runs':
+        cmd_runs(db)
+    elif cmd == 'fastest' and len(args) >= 1:
+        lt = args[1] if len(args) >= 2 else 'throughput'
+        clas = args[2] if len(args) >= 3 else None
+        cmd_fastest(db, args[0], lt, clas)
+    elif cmd == 'trend' and len(args) >= 3:
+        lt = args[3] if len(args) >= 4 else 'throughput'
+        cmd_trend(db, args[0], args[1], args[2], lt)
+    elif cmd == 'pivot' and len(args) >= 1:
+        lt = args[1] if len(args) >= 2 else 'throughput'
+        cmd_pivot(db, args[0], lt)
+    else:
+        usage()
+
+
+if __name__ == '__main__':
+    main()
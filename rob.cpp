@@ -0,0 +1,192 @@
+#include "common.hpp"
+
+/*
+ * out-of-order window sizing
+ *
+ * Two independent pointer chains over a buffer much larger than LLC,
+ * with K filler instructions after each load:
+ *
+ *       mov rax, [rax]        ; miss
+ *       filler x K
+ *       mov rbx, [rbx]        ; miss
+ *       filler x K
+ *
+ * While the second load fits in the window together with the first one,
+ * both misses overlap and a step costs about one miss latency. Once the
+ * K fillers exhaust the resource they consume, the misses serialize and
+ * a step costs about two.
+ *
+ * The fillers cost time of their own, so every K is also run with both
+ * chains on a line that points to itself (L1 hits). "miss" is the step
+ * time minus that filler-only time, and the knee (first K where miss
+ * exceeds ROB_KNEE times the K=0 value) is reported as the size of that
+ * resource.
+ *
+ * The heads chase() writes back are carried from run to run, so every
+ * run walks lines no earlier run has touched : the two chains start half
+ * the buffer apart and all runs together walk less than half of it.
+ *
+ *   nop   : ROB entries only
+ *   gpr   : mov r32,imm      (ROB + integer register file)
+ *   vec   : pshufd x,x15,0   (ROB + vector register file)
+ *   load  : mov r32,[mem]    (ROB + load buffer, also takes an integer register)
+ *   store : mov [mem],0      (ROB + store buffer)
+ *
+ * Register file knees do not include the registers holding
+ * architectural state.
+ */
+
+#ifdef __linux
+
+#include <sys/mman.h>
+
+#define ROB_SIZE (256*1024*1024)
+#define ROB_LINE 64
+#define ROB_MAX_K 1024
+#define ROB_STEP_K 16
+
+/* miss part of a step, relative to K=0, above which the misses are serialized */
+#define ROB_KNEE 1.5
+
+/* two lines pointing to themselves, for the filler-only time */
+static char MIE_ALIGN(64) rob_self[2*ROB_LINE];
+
+enum rob_filler_kind {
+    ROB_NOP,
+    ROB_GPR,
+    ROB_VEC,
+    ROB_LOAD,
+    ROB_STORE,
+    ROB_NUM_FILLER
+};
+
+static const char *rob_filler_name[] = {
+    "nop",
+    "gpr",
+    "vec",
+    "load",
+    "store",
+};
+
+struct rob_filler {
+    enum rob_filler_kind kind;
+    int k;
+    int n;
+
+    /* every filler is at most 7 bytes (disp8 addressing), so ROB_MAX_K
+     * of them fit in CHASE_FILLER_BYTES */
+    void operator()(Xbyak::CodeGenerator *g) {
+        for (int i=0; i<k; i++, n++) {
+            /* 2 chains : chase_reg(0), chase_reg(1) are in use */
+            Xbyak::Reg64 r = chase_reg(2 + n % (CHASE_MAX_CHAIN-2));
+
+            switch (kind) {
+            case ROB_NOP:
+                g->nop();
+                break;
+            case ROB_GPR:
+                g->mov(r.cvt32(), 1);
+                break;
+            case ROB_VEC:
+                g->pshufd(Xbyak::Xmm(n % 15), g->xmm15, 0);
+                break;
+            case ROB_LOAD:
+                g->mov(r.cvt32(), g->ptr[g->rdi + (n % 32) * 4]);
+                break;
+            case ROB_STORE:
+                /* zero_mem must stay zero */
+                g->mov(g->dword[g->rdi + (n % 32) * 4], 0);
+                break;
+            default:
+                break;
+            }
+        }
+    }
+};
+
+void test_rob()
+{
+    size_t num_line = ROB_SIZE / ROB_LINE;
+    void *map = mmap(NULL, ROB_SIZE, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+    if (map == MAP_FAILED) {
+        perror("rob : mmap");
+        return;
+    }
+    madvise(map, ROB_SIZE, MADV_HUGEPAGE);
+
+    char *p = (char*)map;
+    unsigned int *order = new unsigned int[num_line];
+
+    for (size_t i=0; i<num_line; i++) {
+        order[i] = i;
+    }
+
+    unsigned long long seed = 1;
+    for (size_t i=num_line-1; i>0; i--) {
+        seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+        size_t j = (seed >> 24) % (i+1);
+        unsigned int t = order[i];
+        order[i] = order[j];
+        order[j] = t;
+    }
+
+    for (size_t i=0; i<num_line; i++) {
+        void **node = (void**)(p + (size_t)order[i] * ROB_LINE);
+        *node = p + (size_t)order[(i+1) % num_line] * ROB_LINE;
+    }
+
+    char name[128];
+    double miss[ROB_MAX_K/ROB_STEP_K + 1];
+
+    void *heads[2];
+    heads[0] = p + (size_t)order[0] * ROB_LINE;
+    heads[1] = p + (size_t)order[num_line/2] * ROB_LINE;
+
+    void *self[2] = {rob_self, rob_self + ROB_LINE};
+    *(void**)self[0] = self[0];
+    *(void**)self[1] = self[1];
+
+    for (int fi=0; fi<ROB_NUM_FILLER; fi++) {
+        int num_k = 0;
+
+        for (int k=0; k<=ROB_MAX_K; k+=ROB_STEP_K, num_k++) {
+            rob_filler f = {(enum rob_filler_kind)fi, k, 0};
+            double step = chase(heads, 2, 512, 4, f);
+
+            rob_filler ff = {(enum rob_filler_kind)fi, k, 0};
+            double filler_only = chase(self, 2, 512, 4, ff);
+
+            miss[num_k] = step - filler_only;
+
+            lt_result r;
+            r.cpi = step;
+            r.ipc = (2 + 2*k) / step;
+            r.upi = -1;
+
+            snprintf(name, sizeof(name), "%s K=%d", rob_filler_name[fi], k);
+            print_result("rob", name, "latency", r);
+            report_value("rob", name, "miss", miss[num_k]);
+        }
+
+        int knee = -1;
+        for (int i=1; i<num_k; i++) {
+            if (miss[i] > miss[0] * ROB_KNEE) {
+                knee = i * ROB_STEP_K;
+                break;
+            }
+        }
+
+        report_value("rob", rob_filler_name[fi], "window", knee);
+    }
+
+    delete [] order;
+    munmap(map, ROB_SIZE);
+}
+
+#else
+
+void test_rob()
+{
+}
+
+#endif
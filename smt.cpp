@@ -0,0 +1,373 @@
+#include "common.hpp"
+
+/*
+ * SMT co-run (--smt, --smt-pair=a,b)
+ *
+ * The same JITed kernel (or a pair of kernels) runs on both hyperthreads
+ * of one physical core. Both threads are pinned, open their own cycle
+ * counter, run once to warm up and meet at a barrier. Then each thread
+ * repeats its kernel until both have done SMT_RUNS runs, so the faster
+ * one keeps competing while the slower one finishes. A thread only counts
+ * the runs it completed before the other one raised the stop flag, so the
+ * cycles per run cover the overlap and never a run alone. Per thread ipc,
+ * the sum, and the sum relative to the solo run are reported:
+ *
+ *   scaling 2.0 : siblings don't compete (latency bound, separate ports)
+ *   scaling 1.0 : resource is fully shared, each thread gets half
+ *
+ * With --smt every throughput test in lt() is also co-run against
+ * itself. test_smt() runs a table of kernel pairs (or the one given by
+ * --smt-pair).
+ */
+
+#ifdef __linux
+
+#include <pthread.h>
+#include <sched.h>
+
+static int smt_cpu[2] = {-1, -1};
+static const char *smt_pair[2];
+
+static int
+sibling_of(int cpu, const cpu_set_t *set)
+{
+    char path[256], buf[256];
+    snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/topology/thread_siblings_list", cpu);
+
+    FILE *fp = fopen(path, "r");
+    if (fp == NULL) {
+        return -1;
+    }
+
+    int sib = -1;
+    if (fgets(buf, sizeof(buf), fp)) {
+        /* "0,8" or "0-1" */
+        int a, b;
+        if (sscanf(buf, "%d%*[,-]%d", &a, &b) == 2) {
+            sib = (a == cpu) ? b : a;
+        }
+    }
+    fclose(fp);
+
+    if (sib == -1 || sib >= CPU_SETSIZE || !CPU_ISSET(sib, set)) {
+        return -1;
+    }
+    return sib;
+}
+
+bool
+smt_init(const char *pair)
+{
+    /* called once per core type on hybrid cpus : forget the last type's pair */
+    smt_cpu[0] = smt_cpu[1] = -1;
+
+    /* the cpus of this core type when called from the hybrid pass */
+    cpu_set_t set;
+    if (sched_getaffinity(0, sizeof(set), &set) != 0) {
+        return false;
+    }
+
+    for (int cpu=0; cpu<CPU_SETSIZE; cpu++) {
+        if (!CPU_ISSET(cpu, &set)) {
+            continue;
+        }
+
+        int sib = sibling_of(cpu, &set);
+        if (sib != -1) {
+            smt_cpu[0] = cpu;
+            smt_cpu[1] = sib;
+            break;
+        }
+    }
+
+    if (smt_cpu[0] == -1) {
+        fprintf(stderr, "smt : no pair of sibling threads available (SMT off?)\n");
+        /* stay on the cpus the caller pinned to */
+        sched_setaffinity(0, sizeof(set), &set);
+        return false;
+    }
+
+    if (pair) {
+        static char buf[256];
+        snprintf(buf, sizeof(buf), "%s", pair);
+
+        char *comma = strchr(buf, ',');
+        if (comma == NULL) {
+            fprintf(stderr, "smt : --smt-pair expects two kernel names, \"a,b\"\n");
+            smt_cpu[0] = smt_cpu[1] = -1;
+            return false;
+        }
+        *comma = '\0';
+        smt_pair[0] = buf;
+        smt_pair[1] = comma + 1;
+    }
+
+    /* solo results in lt() are measured on the same core */
+    cpu_set_t one;
+    CPU_ZERO(&one);
+    CPU_SET(smt_cpu[0], &one);
+    sched_setaffinity(0, sizeof(one), &one);
+
+    return true;
+}
+
+/* timed runs of the slower thread */
+#define SMT_RUNS 4
+
+struct smt_thread {
+    int cpu;
+    void (*f)(void);
+    int runs;                   /* completed inside the overlap, read by the sibling */
+    double cycles;              /* per run, -1 : no counter */
+};
+
+static pthread_barrier_t smt_barrier;
+static smt_thread *smt_threads;
+static int smt_num_thread;
+static int smt_stop;
+
+static long long
+read_fd(int fd)
+{
+    long long v = 0;
+    if (read(fd, &v, sizeof(v)) != sizeof(v)) {
+        return -1;
+    }
+    return v;
+}
+
+static bool
+all_done(void)
+{
+    for (int i=0; i<smt_num_thread; i++) {
+        if (__atomic_load_n(&smt_threads[i].runs, __ATOMIC_ACQUIRE) < SMT_RUNS) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void *
+smt_thread_main(void *arg)
+{
+    smt_thread *t = (smt_thread*)arg;
+
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(t->cpu, &set);
+    sched_setaffinity(0, sizeof(set), &set);
+
+    int fd = cycle_counter_open();
+
+    t->f();
+
+    pthread_barrier_wait(&smt_barrier);
+
+    long long b = (fd == -1) ? -1 : read_fd(fd);
+    long long last = b;
+
+    while (!__atomic_load_n(&smt_stop, __ATOMIC_ACQUIRE)) {
+        t->f();
+        long long e = (fd == -1) ? -1 : read_fd(fd);
+
+        /* the sibling stopped during this run, it was partly alone */
+        if (__atomic_load_n(&smt_stop, __ATOMIC_ACQUIRE)) {
+            break;
+        }
+
+        last = e;
+        __atomic_store_n(&t->runs, t->runs + 1, __ATOMIC_RELEASE);
+
+        if (all_done()) {
+            __atomic_store_n(&smt_stop, 1, __ATOMIC_RELEASE);
+        }
+    }
+
+    if (fd != -1) {
+        close(fd);
+    }
+
+    t->cycles = (b < 0 || last < 0 || t->runs == 0) ? -1 : (last - b) / (double)t->runs;
+    return NULL;
+}
+
+bool
+smt_corun(void (*a)(void), void (*b)(void), double *cycles_a, double *cycles_b)
+{
+    int num_thread = b ? 2 : 1;
+    smt_thread t[2] = {{smt_cpu[0], a, 0, 0}, {smt_cpu[1], b, 0, 0}};
+    pthread_t th[2];
+
+    smt_threads = t;
+    smt_num_thread = num_thread;
+    smt_stop = 0;
+    pthread_barrier_init(&smt_barrier, NULL, num_thread);
+
+    for (int i=0; i<num_thread; i++) {
+        pthread_create(&th[i], NULL, smt_thread_main, &t[i]);
+    }
+    for (int i=0; i<num_thread; i++) {
+        pthread_join(th[i], NULL);
+    }
+
+    pthread_barrier_destroy(&smt_barrier);
+
+    *cycles_a = t[0].cycles;
+    if (cycles_b) {
+        *cycles_b = t[1].cycles;
+    }
+
+    return t[0].cycles > 0 && (b == NULL || t[1].cycles > 0);
+}
+
+typedef Xbyak::CodeGenerator *(*smt_gen_t)(int *num_insn);
+
+struct smt_kernel {
+    const char *name;
+    smt_gen_t gen;
+    const bool *need;           /* cpuinfo flag, NULL : always */
+};
+
+template <typename RegType, typename F>
+static Xbyak::CodeGenerator *
+smt_gen(F f, int *num_insn, enum operand_type ot)
+{
+    *num_insn = get_num_insn<RegType>();
+    return new Gen<RegType,F>(f, false, NUM_LOOP, *num_insn, LT_THROUGHPUT, ot);
+}
+
+#define SMT_KERNEL(rt, name, expr, ot, need)                                    \
+    {name,                                                                      \
+     [](int *num_insn) -> Xbyak::CodeGenerator * {                              \
+         return smt_gen<Xbyak::rt>(                                             \
+             [](Xbyak::CodeGenerator *g, Xbyak::rt dst, Xbyak::rt src){expr;},  \
+             num_insn, ot);                                                     \
+     },                                                                         \
+     need}
+
+static const smt_kernel kernels[] = {
+    SMT_KERNEL(Reg64, "add", (g->add(dst, src)), OT_INT, NULL),
+    SMT_KERNEL(Reg64, "imul", (g->imul(dst, src)), OT_INT, NULL),
+    SMT_KERNEL(Reg64, "load", (g->mov(dst, g->ptr[g->rdx])), OT_INT, NULL),
+    SMT_KERNEL(Reg64, "store", (g->mov(g->ptr[g->rdx + 256], g->rdi)), OT_INT, NULL),
+    SMT_KERNEL(Xmm, "addps", (g->addps(dst, src)), OT_FP32, NULL),
+    SMT_KERNEL(Xmm, "mulps", (g->mulps(dst, src)), OT_FP32, NULL),
+    SMT_KERNEL(Xmm, "divps", (g->divps(dst, src)), OT_FP32, NULL),
+    SMT_KERNEL(Xmm, "pshufb", (g->pshufb(dst, src)), OT_INT, NULL),
+    SMT_KERNEL(Ymm, "vfmadd231ps", (g->vfmadd231ps(dst, src, src)), OT_FP32, &info.have_fma),
+};
+
+static const char *default_pairs[][2] = {
+    {"add", "add"},
+    {"add", "mulps"},
+    {"add", "load"},
+    {"load", "store"},
+    {"mulps", "divps"},
+    {"addps", "pshufb"},
+    {"imul", "mulps"},
+    {"vfmadd231ps", "vfmadd231ps"},
+    {"vfmadd231ps", "add"},
+};
+
+static const smt_kernel *
+find_kernel(const char *name)
+{
+    for (size_t i=0; i<sizeof(kernels)/sizeof(kernels[0]); i++) {
+        if (strcmp(kernels[i].name, name) == 0) {
+            return &kernels[i];
+        }
+    }
+    return NULL;
+}
+
+static void
+run_pair(const char *name_a, const char *name_b)
+{
+    const smt_kernel *k[2] = {find_kernel(name_a), find_kernel(name_b)};
+    char name[128];
+
+    for (int i=0; i<2; i++) {
+        if (k[i] == NULL) {
+            fprintf(stderr, "smt : unknown kernel \"%s\"\n", i ? name_b : name_a);
+            return;
+        }
+        if (k[i]->need && !*k[i]->need) {
+            return;
+        }
+    }
+
+    int num_insn[2];
+    Xbyak::CodeGenerator *g[2];
+    void (*exec[2])(void);
+    double solo[2], co[2];
+    double cycles[2];
+
+    for (int i=0; i<2; i++) {
+        g[i] = k[i]->gen(&num_insn[i]);
+        exec[i] = (void (*)(void))g[i]->getCode();
+    }
+
+    memset(zero_mem, 0, sizeof(zero_mem));
+
+    bool ok = true;
+    for (int i=0; i<2; i++) {
+        ok = ok && smt_corun(exec[i], NULL, &cycles[i], NULL);
+        solo[i] = num_insn[i] * NUM_LOOP / cycles[i];
+    }
+
+    ok = ok && smt_corun(exec[0], exec[1], &cycles[0], &cycles[1]);
+
+    for (int i=0; i<2; i++) {
+        co[i] = num_insn[i] * NUM_LOOP / cycles[i];
+        delete g[i];
+    }
+
+    if (!ok) {
+        fprintf(stderr, "smt : cycle counter is not available in threads\n");
+        return;
+    }
+
+    snprintf(name, sizeof(name), "%s + %s", name_a, name_b);
+    report_value("smt", name, "solo ipc a", solo[0]);
+    report_value("smt", name, "solo ipc b", solo[1]);
+    report_value("smt", name, "ipc a", co[0]);
+    report_value("smt", name, "ipc b", co[1]);
+    report_value("smt", name, "scaling", co[0]/solo[0] + co[1]/solo[1]);
+}
+
+void test_smt()
+{
+    if (!smt_mode) {
+        return;
+    }
+
+    if (smt_pair[0]) {
+        run_pair(smt_pair[0], smt_pair[1]);
+        return;
+    }
+
+    for (size_t i=0; i<sizeof(default_pairs)/sizeof(default_pairs[0]); i++) {
+        run_pair(default_pairs[i][0], default_pairs[i][1]);
+    }
+}
+
+#else
+
+bool
+smt_init(const char *)
+{
+    fprintf(stderr, "smt : not supported on this platform\n");
+    return false;
+}
+
+bool
+smt_corun(void (*)(void), void (*)(void), double *, double *)
+{
+    return false;
+}
+
+void test_smt()
+{
+}
+
+#endif
@@ -0,0 +1,728 @@
+#include "common.hpp"
+#include <ctype.h>
+
+/*
+ * user snippets (--snippet FILE)
+ *
+ *   # comment
+ *   class ymm                  xmm, ymm, zmm or reg64 : registers Gen rotates
+ *   chain ymm0                 register carrying the dependency in the text
+ *   type fp32                  int, fp32, fp64 : save/restore and killdep flavor
+ *
+ *   [fma + add]
+ *   vfmadd231ps ymm0, ymm1, ymm1
+ *   vaddps ymm0, ymm0, [mem+32]
+ *
+ * class/chain/type apply to the blocks that follow. Every block is one f()
+ * of Gen : the chain register (any width of it, xmm0/ymm0/zmm0 or
+ * rax/eax) is replaced with the register Gen passes, v8 for latency and
+ * v4..v15 (r8..r15 for reg64) for throughput. CPI is per block.
+ *
+ * Other registers the text may use as scratch : xmm0-3/ymm0-3/zmm0-3,
+ * rax/eax, rsi/esi. They are zeroed before the loop (by the type of the
+ * block), so a scratch source never holds a denormal or NaN. [mem] and
+ * [mem+N] address zero_mem (rdx), with an optional
+ * byte/word/dword/qword/xmmword/ymmword/zmmword [ptr] size.
+ *
+ * Only the mnemonics in snip_ops[] are accepted. cpuid is not checked per
+ * instruction, an unsupported one stops bench with SIGILL.
+ */
+
+#define SNIP_MAX_BLOCK 256
+#define SNIP_MAX_INSN 64
+#define SNIP_MAX_ARG 4
+
+enum snip_class {
+    SNIP_XMM,
+    SNIP_YMM,
+    SNIP_ZMM,
+    SNIP_REG64,
+};
+
+enum snip_kind {
+    SA_VEC,
+    SA_GPR,
+    SA_MEM,
+    SA_IMM,
+};
+
+struct snip_arg {
+    enum snip_kind kind;
+    int idx;
+    int bit;                    /* register width, memory size (0 : unsized) */
+    bool chain;                 /* replaced by the Gen register */
+    long long imm;              /* immediate, memory displacement */
+};
+
+/* an argument as xbyak operands, for one emit */
+struct snip_reg {
+    enum snip_kind kind;
+    int bit;
+    Xbyak::Xmm vec;             /* sliced Ymm/Zmm keep their width */
+    Xbyak::Ymm ymm;             /* for ymm/zmm only instructions */
+    Xbyak::Reg64 r64;
+    Xbyak::Reg32 r32;
+    Xbyak::Address m;
+
+    snip_reg(Xbyak::CodeGenerator *g, const snip_arg &a, int chain_idx)
+        :kind(a.kind), bit(a.bit), m(mem(g, a))
+    {
+        int idx = a.chain ? chain_idx : a.idx;
+
+        if (a.kind == SA_VEC) {
+            if (a.bit == 512) {
+                vec = ymm = Xbyak::Zmm(idx);
+            } else if (a.bit == 256) {
+                vec = ymm = Xbyak::Ymm(idx);
+            } else {
+                vec = Xbyak::Xmm(idx);
+            }
+        } else if (a.kind == SA_GPR) {
+            r64 = Xbyak::Reg64(idx);
+            r32 = Xbyak::Reg32(idx);
+        }
+    }
+
+    static Xbyak::Address mem(Xbyak::CodeGenerator *g, const snip_arg &a) {
+        int disp = (a.kind == SA_MEM) ? (int)a.imm : 0;
+
+        switch (a.bit) {
+        case 8:
+            return g->byte[g->rdx + disp];
+        case 16:
+            return g->word[g->rdx + disp];
+        case 32:
+            return g->dword[g->rdx + disp];
+        case 64:
+            return g->qword[g->rdx + disp];
+        case 128:
+            return g->xword[g->rdx + disp];
+        case 256:
+            return g->yword[g->rdx + disp];
+        case 512:
+            return g->zword[g->rdx + disp];
+        default:
+            return g->ptr[g->rdx + disp];
+        }
+    }
+
+    const Xbyak::Reg32e &gpr() const {
+        if (bit == 64) {
+            return r64;
+        }
+        return r32;
+    }
+
+    /* reg or mem operand */
+    const Xbyak::Operand &rm() const {
+        if (kind == SA_MEM) {
+            return m;
+        } else if (kind == SA_VEC) {
+            return vec;
+        }
+        return gpr();
+    }
+};
+
+typedef void (*snip_emit_t)(Xbyak::CodeGenerator *g, const snip_arg *a, const snip_reg *r);
+
+/*
+ * form : allowed kinds of each argument, space separated.
+ *   v : xmm/ymm/zmm, y : ymm/zmm, g : r64/r32, m : memory, i : immediate
+ */
+struct snip_op {
+    const char *name;
+    const char *form;
+    snip_emit_t emit;
+};
+
+#define SNIP_OP(name, form, expr)                                               \
+    {name, form, [](Xbyak::CodeGenerator *g, const snip_arg *a, const snip_reg *r){(void)a;(void)r;expr;}}
+
+#define SNIP_VV(name) SNIP_OP(#name, "v vm", g->name(r[0].vec, r[1].rm()))
+#define SNIP_VVI(name) SNIP_OP(#name, "v vm i", g->name(r[0].vec, r[1].rm(), (uint8_t)a[2].imm))
+#define SNIP_VVV(name) SNIP_OP(#name, "v v vm", g->name(r[0].vec, r[1].vec, r[2].rm()))
+#define SNIP_YYY(name) SNIP_OP(#name, "y y ym", g->name(r[0].ymm, r[1].ymm, r[2].rm()))
+#define SNIP_YYI(name) SNIP_OP(#name, "y ym i", g->name(r[0].ymm, r[1].rm(), (uint8_t)a[2].imm))
+#define SNIP_VVVI(name) SNIP_OP(#name, "v v vm i", g->name(r[0].vec, r[1].vec, r[2].rm(), (uint8_t)a[3].imm))
+
+/* load or store */
+#define SNIP_MOVV(name)                                                         \
+    SNIP_OP(#name, "vm vm",                                                     \
+            if (a[0].kind == SA_MEM) {g->name(r[0].m, r[1].vec);} else {g->name(r[0].vec, r[1].rm());})
+
+#define SNIP_ALU(text, name)                                                    \
+    SNIP_OP(text, "gm gmi",                                                     \
+            if (a[1].kind == SA_IMM) {g->name(r[0].rm(), (uint32_t)a[1].imm);} else {g->name(r[0].rm(), r[1].rm());})
+
+#define SNIP_UNARY(text, name) SNIP_OP(text, "gm", g->name(r[0].rm()))
+#define SNIP_SHIFT(name) SNIP_OP(#name, "gm i", g->name(r[0].rm(), (int)a[1].imm))
+#define SNIP_RRM(name) SNIP_OP(#name, "g gm", g->name(r[0].gpr(), r[1].rm()))
+#define SNIP_RRRM(name) SNIP_OP(#name, "g g gm", g->name(r[0].gpr(), r[1].gpr(), r[2].rm()))
+#define SNIP_RRMR(name) SNIP_OP(#name, "g gm g", g->name(r[0].gpr(), r[1].rm(), r[2].gpr()))
+#define SNIP_NONE(name) SNIP_OP(#name, "", g->name())
+
+static const snip_op snip_ops[] = {
+    /* sse */
+    SNIP_VV(addps), SNIP_VV(addpd), SNIP_VV(addss), SNIP_VV(addsd),
+    SNIP_VV(subps), SNIP_VV(subpd), SNIP_VV(mulps), SNIP_VV(mulpd),
+    SNIP_VV(mulss), SNIP_VV(mulsd), SNIP_VV(divps), SNIP_VV(divpd),
+    SNIP_VV(divss), SNIP_VV(divsd), SNIP_VV(sqrtps), SNIP_VV(sqrtpd),
+    SNIP_VV(minps), SNIP_VV(maxps), SNIP_VV(andps), SNIP_VV(orps), SNIP_VV(xorps),
+    SNIP_VV(rcpps), SNIP_VV(rsqrtps),
+    SNIP_VV(cvtdq2ps), SNIP_VV(cvtps2dq), SNIP_VV(cvtps2pd), SNIP_VV(cvtpd2ps),
+    SNIP_VV(paddb), SNIP_VV(paddw), SNIP_VV(paddd), SNIP_VV(paddq),
+    SNIP_VV(psubd), SNIP_VV(pmulld), SNIP_VV(pmuludq), SNIP_VV(pmaddwd),
+    SNIP_VV(pand), SNIP_VV(por), SNIP_VV(pxor), SNIP_VV(pshufb),
+    SNIP_VV(pcmpeqd), SNIP_VV(pcmpgtd), SNIP_VV(pminsd), SNIP_VV(pmaxsd),
+    SNIP_VV(punpcklbw), SNIP_VV(unpcklps),
+    SNIP_VV(aesenc), SNIP_VV(aesdec),
+    SNIP_VVI(shufps), SNIP_VVI(pshufd), SNIP_VVI(roundps), SNIP_VVI(palignr),
+    SNIP_VVI(blendps), SNIP_VVI(pclmulqdq),
+    SNIP_MOVV(movaps), SNIP_MOVV(movups), SNIP_MOVV(movdqa), SNIP_MOVV(movdqu),
+
+    /* avx, avx2, fma, avx512 (zmm) */
+    SNIP_VVV(vaddps), SNIP_VVV(vaddpd), SNIP_VVV(vsubps), SNIP_VVV(vsubpd),
+    SNIP_VVV(vmulps), SNIP_VVV(vmulpd), SNIP_VVV(vdivps), SNIP_VVV(vdivpd),
+    SNIP_VVV(vminps), SNIP_VVV(vmaxps), SNIP_VVV(vandps), SNIP_VVV(vorps), SNIP_VVV(vxorps),
+    SNIP_VVV(vpaddb), SNIP_VVV(vpaddw), SNIP_VVV(vpaddd), SNIP_VVV(vpaddq),
+    SNIP_VVV(vpsubd), SNIP_VVV(vpmulld), SNIP_VVV(vpmuludq), SNIP_VVV(vpmaddwd),
+    SNIP_VVV(vpand), SNIP_VVV(vpor), SNIP_VVV(vpxor), SNIP_VVV(vpshufb),
+    SNIP_VVV(vpcmpeqd), SNIP_VVV(vpminsd), SNIP_VVV(vpmaxsd),
+    SNIP_VVV(vpunpcklbw), SNIP_VVV(vunpcklps),
+    SNIP_YYY(vpermd), SNIP_YYY(vpermps),
+    SNIP_VVV(vfmadd132ps), SNIP_VVV(vfmadd213ps), SNIP_VVV(vfmadd231ps),
+    SNIP_VVV(vfmadd231pd), SNIP_VVV(vfnmadd231ps),
+    SNIP_VV(vsqrtps), SNIP_VV(vsqrtpd), SNIP_VV(vrcpps), SNIP_VV(vrsqrtps),
+    SNIP_VV(vcvtdq2ps), SNIP_VV(vcvtps2dq), SNIP_VV(vcvtps2pd), SNIP_VV(vcvtpd2ps),
+    SNIP_VV(vbroadcastss), SNIP_VV(vpbroadcastd), SNIP_VV(vptest),
+    SNIP_VVI(vpshufd), SNIP_YYI(vpermq), SNIP_YYI(vpermpd), SNIP_VVI(vroundps),
+    SNIP_VVVI(vshufps), SNIP_VVVI(vblendps), SNIP_VVVI(vpblendd), SNIP_VVVI(vpalignr),
+    SNIP_MOVV(vmovaps), SNIP_MOVV(vmovups), SNIP_MOVV(vmovdqa), SNIP_MOVV(vmovdqu),
+
+    /* integer */
+    SNIP_ALU("add", add), SNIP_ALU("sub", sub), SNIP_ALU("adc", adc), SNIP_ALU("sbb", sbb),
+    SNIP_ALU("and", and_), SNIP_ALU("or", or_), SNIP_ALU("xor", xor_), SNIP_ALU("cmp", cmp),
+    SNIP_OP("mov", "gm gmi",
+            if (a[1].kind == SA_IMM) {g->mov(r[0].rm(), (size_t)a[1].imm);} else {g->mov(r[0].rm(), r[1].rm());}),
+    SNIP_OP("test", "gm gi",
+            if (a[1].kind == SA_IMM) {g->test(r[0].rm(), (uint32_t)a[1].imm);} else {g->test(r[0].rm(), r[1].gpr());}),
+    SNIP_UNARY("inc", inc), SNIP_UNARY("dec", dec), SNIP_UNARY("neg", neg), SNIP_UNARY("not", not_),
+    SNIP_SHIFT(shl), SNIP_SHIFT(shr), SNIP_SHIFT(sar), SNIP_SHIFT(rol), SNIP_SHIFT(ror),
+    SNIP_RRM(imul), SNIP_RRM(popcnt), SNIP_RRM(lzcnt), SNIP_RRM(tzcnt),
+    SNIP_RRM(bsf), SNIP_RRM(bsr), SNIP_RRM(crc32),
+    SNIP_RRM(cmove), SNIP_RRM(cmovne), SNIP_RRM(cmovb), SNIP_RRM(cmova),
+    SNIP_RRM(cmovl), SNIP_RRM(cmovg),
+    SNIP_OP("imul", "g gm i", g->imul(r[0].gpr(), r[1].rm(), (int)a[2].imm)),
+    SNIP_OP("rorx", "g gm i", g->rorx(r[0].gpr(), r[1].rm(), (uint8_t)a[2].imm)),
+    SNIP_OP("lea", "g m", g->lea(r[0].gpr(), r[1].m)),
+    SNIP_RRRM(andn), SNIP_RRRM(pdep), SNIP_RRRM(pext), SNIP_RRRM(mulx),
+    SNIP_RRMR(bzhi), SNIP_RRMR(bextr), SNIP_RRMR(shlx), SNIP_RRMR(shrx), SNIP_RRMR(sarx),
+
+    SNIP_NONE(nop), SNIP_NONE(pause), SNIP_NONE(lfence), SNIP_NONE(mfence), SNIP_NONE(sfence),
+    SNIP_NONE(vzeroupper),
+};
+
+struct snip_insn {
+    const snip_op *op;
+    int num_arg;
+    snip_arg args[SNIP_MAX_ARG];
+};
+
+struct snip_block {
+    char name[128];
+    enum snip_class cls;
+    enum operand_type ot;
+    int num_insn;
+    snip_insn insns[SNIP_MAX_INSN];
+};
+
+static snip_block blocks[SNIP_MAX_BLOCK];
+static int num_block;
+
+struct snip_parser {
+    const char *path;
+    int line;
+    enum snip_class cls;
+    enum operand_type ot;
+    snip_arg chain;             /* kind SA_IMM : not declared */
+    bool chain_used;
+};
+
+static bool
+snip_error(snip_parser *p, const char *msg, const char *arg)
+{
+    fprintf(stderr, "%s:%d: %s%s%s\n", p->path, p->line, msg, arg ? " : " : "", arg ? arg : "");
+    return false;
+}
+
+static char *
+trim(char *s)
+{
+    while (isspace((unsigned char)*s)) {
+        s++;
+    }
+
+    char *e = s + strlen(s);
+    while (e > s && isspace((unsigned char)e[-1])) {
+        *--e = '\0';
+    }
+
+    return s;
+}
+
+static bool
+parse_reg(const char *s, snip_arg *a)
+{
+    static const char *r64[] = {"rax","rcx","rdx","rbx","rsp","rbp","rsi","rdi",
+                                "r8","r9","r10","r11","r12","r13","r14","r15"};
+    static const char *r32[] = {"eax","ecx","edx","ebx","esp","ebp","esi","edi",
+                                "r8d","r9d","r10d","r11d","r12d","r13d","r14d","r15d"};
+
+    for (int i=0; i<16; i++) {
+        if (strcmp(s, r64[i]) == 0 || strcmp(s, r32[i]) == 0) {
+            a->kind = SA_GPR;
+            a->idx = i;
+            a->bit = (strcmp(s, r64[i]) == 0) ? 64 : 32;
+            return true;
+        }
+    }
+
+    static const char *vec[] = {"xmm", "ymm", "zmm"};
+    static const int vec_bit[] = {128, 256, 512};
+
+    for (int i=0; i<3; i++) {
+        char *end;
+        if (strncmp(s, vec[i], 3) == 0 && isdigit((unsigned char)s[3])) {
+            long idx = strtol(s + 3, &end, 10);
+            if (*end == '\0' && idx < 32) {
+                a->kind = SA_VEC;
+                a->idx = idx;
+                a->bit = vec_bit[i];
+                return true;
+            }
+        }
+    }
+
+    return false;
+}
+
+static bool
+parse_arg(snip_parser *p, char *s, snip_arg *a)
+{
+    static const char *size_name[] = {"byte", "word", "dword", "qword", "xmmword", "ymmword", "zmmword"};
+    static const int size_bit[] = {8, 16, 32, 64, 128, 256, 512};
+
+    memset(a, 0, sizeof(*a));
+    s = trim(s);
+
+    for (int i=0; i<7; i++) {
+        size_t len = strlen(size_name[i]);
+        if (strncmp(s, size_name[i], len) == 0 && (isspace((unsigned char)s[len]) || s[len] == '[')) {
+            a->bit = size_bit[i];
+            s = trim(s + len);
+            if (strncmp(s, "ptr", 3) == 0) {
+                s = trim(s + 3);
+            }
+            break;
+        }
+    }
+
+    if (*s == '[') {
+        /* [mem] [mem+N] */
+        char *e = strchr(s, ']');
+        if (e == NULL || e[1] != '\0') {
+            return snip_error(p, "bad memory operand", s);
+        }
+        *e = '\0';
+
+        char *in = trim(s + 1);
+        if (strncmp(in, "mem", 3) != 0) {
+            return snip_error(p, "memory operands are [mem] or [mem+N]", in);
+        }
+        in = trim(in + 3);
+
+        a->kind = SA_MEM;
+        a->imm = 0;
+        if (*in == '+') {
+            char *end;
+            a->imm = strtoll(trim(in + 1), &end, 0);
+            if (*trim(end) != '\0' || a->imm < 0 || a->imm >= (long long)sizeof(zero_mem) - 64) {
+                return snip_error(p, "bad displacement", in);
+            }
+        } else if (*in != '\0') {
+            return snip_error(p, "memory operands are [mem] or [mem+N]", in);
+        }
+        return true;
+    }
+
+    if (a->bit) {
+        return snip_error(p, "size prefix without memory operand", s);
+    }
+
+    if (isdigit((unsigned char)*s) || *s == '-') {
+        char *end;
+        a->kind = SA_IMM;
+        a->imm = strtoll(s, &end, 0);
+        if (*end != '\0') {
+            return snip_error(p, "bad immediate", s);
+        }
+        return true;
+    }
+
+    if (!parse_reg(s, a)) {
+        return snip_error(p, "unknown operand", s);
+    }
+
+    if (p->chain.kind != SA_IMM && a->kind == p->chain.kind && a->idx == p->chain.idx) {
+        a->chain = true;
+        p->chain_used = true;
+        return true;
+    }
+
+    bool scratch = (a->kind == SA_VEC) ? (a->idx < 4) : (a->idx == 0 || a->idx == 6);
+    if (!scratch) {
+        return snip_error(p, "register is used by the harness (scratch : xmm0-3, rax, rsi)", s);
+    }
+
+    return true;
+}
+
+static bool
+kind_allowed(const char *form, int pos, const snip_arg *a)
+{
+    static const char kind_char[] = {'v', 'g', 'm', 'i'};
+
+    /* skip to the pos-th word */
+    for (int i=0; i<pos; i++) {
+        form = strchr(form, ' ');
+        if (form == NULL) {
+            return false;
+        }
+        form++;
+    }
+
+    for (; *form && *form != ' '; form++) {
+        if (*form == kind_char[a->kind]) {
+            return true;
+        }
+        if (*form == 'y' && a->kind == SA_VEC && a->bit >= 256) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static int
+form_args(const char *form)
+{
+    if (*form == '\0') {
+        return 0;
+    }
+
+    int n = 1;
+    for (; *form; form++) {
+        if (*form == ' ') {
+            n++;
+        }
+    }
+    return n;
+}
+
+static bool
+parse_insn(snip_parser *p, const char *mnemonic, char *args, snip_insn *in)
+{
+    in->num_arg = 0;
+    char *s = args;
+    while (*s) {
+        if (in->num_arg == SNIP_MAX_ARG) {
+            return snip_error(p, "too many operands", NULL);
+        }
+
+        char *comma = strchr(s, ',');
+        if (comma) {
+            *comma = '\0';
+        }
+        if (!parse_arg(p, s, &in->args[in->num_arg++])) {
+            return false;
+        }
+        if (comma == NULL) {
+            break;
+        }
+        s = comma + 1;
+    }
+
+    bool known = false;
+    for (size_t i=0; i<sizeof(snip_ops)/sizeof(snip_ops[0]); i++) {
+        const snip_op *op = &snip_ops[i];
+        if (strcmp(op->name, mnemonic) != 0) {
+            continue;
+        }
+        known = true;
+
+        if (form_args(op->form) != in->num_arg) {
+            continue;
+        }
+
+        int num_mem = 0;
+        bool ok = true;
+        for (int ai=0; ai<in->num_arg; ai++) {
+            ok = ok && kind_allowed(op->form, ai, &in->args[ai]);
+            num_mem += in->args[ai].kind == SA_MEM;
+        }
+
+        if (ok && num_mem <= 1) {
+            in->op = op;
+            return true;
+        }
+    }
+
+    return snip_error(p, known ? "operands don't match" : "unsupported instruction", mnemonic);
+}
+
+static void
+check_chain_used(const snip_parser *p, const snip_block *b)
+{
+    if (b && !p->chain_used) {
+        fprintf(stderr, "%s:%d: warning : block \"%s\" doesn't use the chain register\n",
+                p->path, p->line, b->name);
+    }
+}
+
+static bool
+parse_file(const char *path)
+{
+    FILE *fp = fopen(path, "r");
+    if (fp == NULL) {
+        perror(path);
+        return false;
+    }
+
+    snip_parser p;
+    p.path = path;
+    p.line = 0;
+    p.cls = SNIP_XMM;
+    p.ot = OT_FP32;
+    p.chain.kind = SA_IMM;
+    p.chain_used = false;
+
+    snip_block *b = NULL;
+    char buf[512];
+    bool ok = true;
+
+    while (ok && fgets(buf, sizeof(buf), fp)) {
+        p.line++;
+
+        char *hash = strchr(buf, '#');
+        if (hash) {
+            *hash = '\0';
+        }
+        char *line = trim(buf);
+        if (*line == '\0') {
+            continue;
+        }
+
+        if (*line == '[') {
+            char *e = strchr(line, ']');
+            if (e == NULL) {
+                ok = snip_error(&p, "unterminated block name", line);
+                break;
+            }
+            if (p.chain.kind == SA_IMM) {
+                ok = snip_error(&p, "no chain register declared before the block", NULL);
+                break;
+            }
+            if (num_block == SNIP_MAX_BLOCK) {
+                ok = snip_error(&p, "too many blocks", NULL);
+                break;
+            }
+            check_chain_used(&p, b);
+
+            *e = '\0';
+            b = &blocks[num_block++];
+            snprintf(b->name, sizeof(b->name), "%s", trim(line + 1));
+            b->cls = p.cls;
+            b->ot = p.ot;
+            b->num_insn = 0;
+            p.chain_used = false;
+            continue;
+        }
+
+        char *word = line;
+        char *rest = line;
+        while (*rest && !isspace((unsigned char)*rest)) {
+            rest++;
+        }
+        if (*rest) {
+            *rest++ = '\0';
+        }
+        rest = trim(rest);
+
+        if (strcmp(word, "class") == 0) {
+            if (strcmp(rest, "xmm") == 0) {
+                p.cls = SNIP_XMM;
+            } else if (strcmp(rest, "ymm") == 0) {
+                p.cls = SNIP_YMM;
+            } else if (strcmp(rest, "zmm") == 0) {
+                p.cls = SNIP_ZMM;
+            } else if (strcmp(rest, "reg64") == 0) {
+                p.cls = SNIP_REG64;
+                p.ot = OT_INT;
+            } else {
+                ok = snip_error(&p, "class is xmm, ymm, zmm or reg64", rest);
+            }
+            p.chain.kind = SA_IMM;
+        } else if (strcmp(word, "chain") == 0) {
+            snip_arg a;
+            if (!parse_reg(rest, &a)) {
+                ok = snip_error(&p, "unknown chain register", rest);
+            } else if ((a.kind == SA_GPR) != (p.cls == SNIP_REG64)) {
+                ok = snip_error(&p, "chain register doesn't match the class", rest);
+            } else {
+                p.chain = a;
+            }
+        } else if (strcmp(word, "type") == 0) {
+            if (strcmp(rest, "int") == 0) {
+                p.ot = OT_INT;
+            } else if (strcmp(rest, "fp32") == 0) {
+                p.ot = OT_FP32;
+            } else if (strcmp(rest, "fp64") == 0) {
+                p.ot = OT_FP64;
+            } else {
+                ok = snip_error(&p, "type is int, fp32 or fp64", rest);
+            }
+        } else if (b == NULL) {
+            ok = snip_error(&p, "instruction outside of a [block]", word);
+        } else if (b->num_insn == SNIP_MAX_INSN) {
+            ok = snip_error(&p, "too many instructions in the block", NULL);
+        } else {
+            for (char *c=word; *c; c++) {
+                *c = tolower((unsigned char)*c);
+            }
+            for (char *c=rest; *c; c++) {
+                *c = tolower((unsigned char)*c);
+            }
+            ok = parse_insn(&p, word, rest, &b->insns[b->num_insn++]);
+        }
+    }
+
+    if (ok) {
+        check_chain_used(&p, b);
+    }
+
+    fclose(fp);
+    return ok;
+}
+
+template <typename RegType>
+struct snip_fn {
+    const snip_block *b;
+
+    void operator () (Xbyak::CodeGenerator *g, RegType dst, RegType) const {
+        int idx = dst.getIdx();
+
+        for (int i=0; i<b->num_insn; i++) {
+            const snip_insn *in = &b->insns[i];
+            snip_reg r[SNIP_MAX_ARG] = {
+                snip_reg(g, in->args[0], idx), snip_reg(g, in->args[1], idx),
+                snip_reg(g, in->args[2], idx), snip_reg(g, in->args[3], idx),
+            };
+            in->op->emit(g, in->args, r);
+        }
+    }
+};
+
+static enum operand_type scratch_ot;
+
+/* Gen leaves xmm0-3, rax and rsi as the caller had them */
+static void
+zero_scratch(Xbyak::CodeGenerator *g)
+{
+    for (int i=0; i<4; i++) {
+        Xbyak::Xmm x(i);
+
+        if (info.have_avx) {
+            switch (scratch_ot) {
+            case OT_INT:
+                g->vpxor(x, x, x);
+                break;
+            case OT_FP32:
+                g->vxorps(x, x, x);
+                break;
+            case OT_FP64:
+                g->vxorpd(x, x, x);
+                break;
+            }
+        } else {
+            switch (scratch_ot) {
+            case OT_INT:
+                g->pxor(x, x);
+                break;
+            case OT_FP32:
+                g->xorps(x, x);
+                break;
+            case OT_FP64:
+                g->xorpd(x, x);
+                break;
+            }
+        }
+    }
+
+    g->xor_(g->eax, g->eax);
+    g->xor_(g->esi, g->esi);
+}
+
+template <typename RegType>
+static void
+run_block(const snip_block *b)
+{
+    snip_fn<RegType> f;
+    f.b = b;
+
+    scratch_ot = b->ot;
+    gen_prologue_hook = zero_scratch;
+
+    try {
+        lt<RegType>(b->name, "latency", f, false, NUM_LOOP, LT_LATENCY, b->ot);
+        lt<RegType>(b->name, "throughput", f, false, NUM_LOOP, LT_THROUGHPUT, b->ot);
+    } catch (const Xbyak::Error &err) {
+        fprintf(stderr, "snippet \"%s\" : %s\n", b->name, Xbyak::ConvertErrorToString(err));
+    }
+
+    gen_prologue_hook = NULL;
+}
+
+bool
+run_snippet_file(const char *path)
+{
+    if (!parse_file(path)) {
+        return false;
+    }
+
+    for (int i=0; i<num_block; i++) {
+        const snip_block *b = &blocks[i];
+
+        if ((b->cls == SNIP_YMM && !info.have_avx) || (b->cls == SNIP_ZMM && !info.have_avx512f)) {
+            fprintf(stderr, "snippet \"%s\" : skipped, %s not supported\n",
+                    b->name, b->cls == SNIP_YMM ? "avx" : "avx512f");
+            continue;
+        }
+
+        switch (b->cls) {
+        case SNIP_XMM:
+            run_block<Xbyak::Xmm>(b);
+            break;
+        case SNIP_YMM:
+            run_block<Xbyak::Ymm>(b);
+            break;
+        case SNIP_ZMM:
+            run_block<Xbyak::Zmm>(b);
+            break;
+        case SNIP_REG64:
+            run_block<Xbyak::Reg64>(b);
+            break;
+        }
+    }
+
+    return true;
+}
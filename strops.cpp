@@ -0,0 +1,375 @@
+#include "common.hpp"
+
+/*
+ * string instructions (rep movs/stos) against a JITed AVX loop
+ *
+ * Every (op, length, src/dst placement) gets its own code, so the AVX
+ * loop is specialized for the length like a memcpy dispatch would be:
+ *
+ *       128 bytes / iteration  (4x vmovdqu ymm)
+ *       32 byte chunks
+ *       tail : one overlapping 32/16/8/4 byte access ending at n, bytes below 4
+ *
+ * rep movsq/stosq copy n/8 qwords and are skipped for n < 8.
+ *
+ * crossover : smallest length from which rep movsb/stosb is at least as
+ * fast as the AVX loop for every larger length in the sweep.
+ */
+
+#define STR_MAX_LEN (8*1024*1024)
+#define STR_PAD 8192
+#define STR_TOTAL_BYTES (64*1024*1024)
+#define STR_MAX_REPS 100000
+
+enum str_op {
+    STR_REP_MOVSB,
+    STR_REP_MOVSQ,
+    STR_AVX_COPY,
+    STR_REP_STOSB,
+    STR_REP_STOSQ,
+    STR_AVX_SET,
+    STR_NUM_OP
+};
+
+static const char *str_op_name[] = {
+    "rep movsb",
+    "rep movsq",
+    "avx copy",
+    "rep stosb",
+    "rep stosq",
+    "avx set",
+};
+
+static bool
+str_is_copy(enum str_op op)
+{
+    return op == STR_REP_MOVSB || op == STR_REP_MOVSQ || op == STR_AVX_COPY;
+}
+
+struct StrGen
+    :public Xbyak::CodeGenerator
+{
+    /* copy/set [rdi+off, rdi+off+size) with one access. size = 32,16,8,4,1 */
+    void avx_access(bool copy, int off, int size) {
+        switch (size) {
+        case 32:
+            if (copy) {
+                vmovdqu(ymm0, ptr[rsi + off]);
+            }
+            vmovdqu(ptr[rdi + off], ymm0);
+            break;
+        case 16:
+            if (copy) {
+                vmovdqu(xmm0, ptr[rsi + off]);
+            }
+            vmovdqu(ptr[rdi + off], xmm0);
+            break;
+        case 8:
+            if (copy) {
+                mov(rax, ptr[rsi + off]);
+            }
+            mov(ptr[rdi + off], rax);
+            break;
+        case 4:
+            if (copy) {
+                mov(eax, ptr[rsi + off]);
+            }
+            mov(ptr[rdi + off], eax);
+            break;
+        default:
+            if (copy) {
+                mov(al, ptr[rsi + off]);
+            }
+            mov(ptr[rdi + off], al);
+            break;
+        }
+    }
+
+    void avx_body(bool copy, size_t n) {
+        if (!copy) {
+            vpxor(xmm0, xmm0, xmm0);
+            xor_(eax, eax);
+        }
+
+        if (n >= 128) {
+            Xbyak::Label loop;
+            mov(rcx, n / 128);
+            L(loop);
+            if (copy) {
+                vmovdqu(ymm0, ptr[rsi + 0]);
+                vmovdqu(ymm1, ptr[rsi + 32]);
+                vmovdqu(ymm2, ptr[rsi + 64]);
+                vmovdqu(ymm3, ptr[rsi + 96]);
+                vmovdqu(ptr[rdi + 0], ymm0);
+                vmovdqu(ptr[rdi + 32], ymm1);
+                vmovdqu(ptr[rdi + 64], ymm2);
+                vmovdqu(ptr[rdi + 96], ymm3);
+                add(rsi, 128);
+            } else {
+                vmovdqu(ptr[rdi + 0], ymm0);
+                vmovdqu(ptr[rdi + 32], ymm0);
+                vmovdqu(ptr[rdi + 64], ymm0);
+                vmovdqu(ptr[rdi + 96], ymm0);
+            }
+            add(rdi, 128);
+            dec(rcx);
+            jnz(loop);
+        }
+
+        int rem = n % 128;
+        int off = 0;
+
+        for (; rem - off >= 32; off += 32) {
+            avx_access(copy, off, 32);
+        }
+
+        int tail = rem - off;
+        if (tail == 0) {
+            return;
+        }
+
+        /* one access ending exactly at n, overlapping bytes already written */
+        static const int sizes[] = {32, 16, 8, 4};
+        for (size_t i=0; i<sizeof(sizes)/sizeof(sizes[0]); i++) {
+            if (n >= (size_t)sizes[i] && tail <= sizes[i]) {
+                avx_access(copy, rem - sizes[i], sizes[i]);
+                return;
+            }
+        }
+
+        while (off < rem) {
+            if (rem - off >= 16) {
+                avx_access(copy, off, 16);
+                off += 16;
+            } else if (rem - off >= 8) {
+                avx_access(copy, off, 8);
+                off += 8;
+            } else if (rem - off >= 4) {
+                avx_access(copy, off, 4);
+                off += 4;
+            } else {
+                avx_access(copy, off, 1);
+                off += 1;
+            }
+        }
+    }
+
+    StrGen(enum str_op op, char *dst, const char *src, size_t n, int reps) {
+        push(rdi);
+        push(rsi);
+
+        mov(r8, (intptr_t)dst);
+        mov(r9, (intptr_t)src);
+        mov(r10, reps);
+
+        align(16);
+        Xbyak::Label outer;
+        L(outer);
+
+        mov(rdi, r8);
+        mov(rsi, r9);
+
+        switch (op) {
+        case STR_REP_MOVSB:
+            mov(rcx, n);
+            rep();
+            movsb();
+            break;
+        case STR_REP_MOVSQ:
+            mov(rcx, n / 8);
+            rep();
+            movsq();
+            break;
+        case STR_REP_STOSB:
+            xor_(eax, eax);
+            mov(rcx, n);
+            rep();
+            stosb();
+            break;
+        case STR_REP_STOSQ:
+            xor_(eax, eax);
+            mov(rcx, n / 8);
+            rep();
+            stosq();
+            break;
+        case STR_AVX_COPY:
+            avx_body(true, n);
+            break;
+        case STR_AVX_SET:
+            avx_body(false, n);
+            break;
+        default:
+            break;
+        }
+
+        dec(r10);
+        jnz(outer);
+
+        if (op == STR_AVX_COPY || op == STR_AVX_SET) {
+            vzeroupper();
+        }
+
+        pop(rsi);
+        pop(rdi);
+        ret();
+    }
+};
+
+/* bytes per cycle */
+static double
+str_run(enum str_op op, char *dst, const char *src, size_t n)
+{
+    long long reps = STR_TOTAL_BYTES / n;
+    if (reps < 16) {
+        reps = 16;
+    }
+    if (reps > STR_MAX_REPS) {
+        reps = STR_MAX_REPS;
+    }
+
+    StrGen g(op, dst, src, n, reps);
+    typedef void (*func_t)(void);
+    func_t exec = (func_t)g.getCode();
+
+    exec();
+
+    long long b = read_cycle_or_exit();
+    exec();
+    long long e = read_cycle_or_exit();
+
+    size_t bytes = n;
+    if (op == STR_REP_MOVSQ || op == STR_REP_STOSQ) {
+        bytes = n / 8 * 8;
+    }
+
+    return bytes * (double)reps / (e-b);
+}
+
+static bool
+str_available(enum str_op op, size_t n)
+{
+    if (op == STR_AVX_COPY || op == STR_AVX_SET) {
+        return info.have_avx;
+    }
+    if (op == STR_REP_MOVSQ || op == STR_REP_STOSQ) {
+        return n >= 8;
+    }
+    return true;
+}
+
+void test_strops()
+{
+    char name[128];
+
+    report_value("string", "cpuid", "ermsb", info.have_ermsb);
+    report_value("string", "cpuid", "fsrm", info.have_fsrm);
+
+    size_t buf_size = STR_MAX_LEN + 2*STR_PAD;
+    char *src_buf = (char*)Xbyak::AlignedMalloc(buf_size, 4096);
+    char *dst_buf = (char*)Xbyak::AlignedMalloc(buf_size, 4096);
+    memset(src_buf, 1, buf_size);
+    memset(dst_buf, 0, buf_size);
+
+    char *src = src_buf + STR_PAD;
+    char *dst = dst_buf + STR_PAD;
+
+    /* length sweep : 2^k and 3*2^k */
+    static size_t lens[64];
+    int num_len = 0;
+    for (size_t n=1; n<=STR_MAX_LEN; n*=2) {
+        lens[num_len++] = n;
+        if (n >= 2 && n*3/2 <= STR_MAX_LEN) {
+            lens[num_len++] = n*3/2;
+        }
+    }
+
+    static double bpc[STR_NUM_OP][64];
+
+    for (int oi=0; oi<STR_NUM_OP; oi++) {
+        enum str_op op = (enum str_op)oi;
+        for (int li=0; li<num_len; li++) {
+            bpc[oi][li] = 0;
+            if (!str_available(op, lens[li])) {
+                continue;
+            }
+
+            bpc[oi][li] = str_run(op, dst, src, lens[li]);
+
+            snprintf(name, sizeof(name), "%s %zu", str_op_name[oi], lens[li]);
+            report_value("string", name, "bytes/cycle", bpc[oi][li]);
+        }
+    }
+
+    if (info.have_avx) {
+        static const enum str_op rep_op[] = {STR_REP_MOVSB, STR_REP_STOSB};
+        static const enum str_op avx_op[] = {STR_AVX_COPY, STR_AVX_SET};
+
+        for (int i=0; i<2; i++) {
+            long long crossover = -1;
+            for (int li=num_len-1; li>=0; li--) {
+                if (bpc[rep_op[i]][li] < bpc[avx_op[i]][li]) {
+                    break;
+                }
+                crossover = lens[li];
+            }
+
+            snprintf(name, sizeof(name), "%s vs %s", str_op_name[rep_op[i]], str_op_name[avx_op[i]]);
+            report_value("string", name, "crossover", crossover);
+        }
+    }
+
+    /* src/dst misalignment */
+    static const size_t align_lens[] = {256, 4096, 1024*1024};
+    static const int offsets[][2] = {
+        {0, 0}, {1, 0}, {0, 1}, {8, 0}, {0, 8}, {32, 0}, {0, 32}, {1, 33}, {63, 1},
+    };
+
+    for (size_t li=0; li<sizeof(align_lens)/sizeof(align_lens[0]); li++) {
+        for (size_t ai=0; ai<sizeof(offsets)/sizeof(offsets[0]); ai++) {
+            for (int oi=0; oi<STR_NUM_OP; oi++) {
+                enum str_op op = (enum str_op)oi;
+                if (!str_available(op, align_lens[li])) {
+                    continue;
+                }
+
+                int so = offsets[ai][0], d_o = offsets[ai][1];
+
+                /* stos-style ops have no source, only the dst offset matters */
+                if (!str_is_copy(op) && so != 0) {
+                    continue;
+                }
+
+                double v = str_run(op, dst + d_o, src + so, align_lens[li]);
+
+                if (str_is_copy(op)) {
+                    snprintf(name, sizeof(name), "%s %zu (src+%d,dst+%d)", str_op_name[oi], align_lens[li], so, d_o);
+                } else {
+                    snprintf(name, sizeof(name), "%s %zu (dst+%d)", str_op_name[oi], align_lens[li], d_o);
+                }
+                report_value("string", name, "bytes/cycle", v);
+            }
+        }
+    }
+
+    /* overlapping copy in one buffer, dst = src + distance */
+    static const int distances[] = {-4096, -64, -8, 1, 8, 32, 63, 64, 128, 4096};
+    size_t overlap_len = 4096;
+    char *base = src_buf + STR_PAD;
+
+    for (size_t di=0; di<sizeof(distances)/sizeof(distances[0]); di++) {
+        for (int oi=0; oi<STR_NUM_OP; oi++) {
+            enum str_op op = (enum str_op)oi;
+            if (!str_is_copy(op) || !str_available(op, overlap_len)) {
+                continue;
+            }
+
+            double v = str_run(op, base + distances[di], base, overlap_len);
+
+            snprintf(name, sizeof(name), "%s %zu (dst=src%+d)", str_op_name[oi], overlap_len, distances[di]);
+            report_value("string", name, "bytes/cycle", v);
+        }
+    }
+
+    Xbyak::AlignedFree(src_buf);
+    Xbyak::AlignedFree(dst_buf);
+}
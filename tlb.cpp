@@ -0,0 +1,218 @@
+#include "common.hpp"
+
+/*
+ * TLB miss cost
+ *
+ * The same page-strided pointer chase (one load per 4KiB page, pages
+ * visited in random order) runs over buffers backed by
+ *
+ *   4k      : madvise(MADV_NOHUGEPAGE)
+ *   thp     : madvise(MADV_HUGEPAGE), 2MiB aligned
+ *   hugetlb : mmap(MAP_HUGETLB), needs vm.nr_hugepages
+ *
+ * Growing the page count walks through L1 DTLB, STLB and page walks for
+ * 4k, while thp/hugetlb stay inside a few 2MiB entries. Each line in a
+ * page is picked so the touched lines spread over all cache sets.
+ *
+ * The page size actually obtained is read back from /proc/self/smaps.
+ */
+
+#ifdef __linux
+
+#include <sys/mman.h>
+
+#define TLB_MAX_PAGES 16384
+#define TLB_STRIDE 4096
+#define HUGE_SIZE (2048*1024)
+
+enum tlb_backing {
+    TLB_4K,
+    TLB_THP,
+    TLB_HUGETLB
+};
+
+static const char *backing_name[] = {
+    "4k",
+    "thp",
+    "hugetlb"
+};
+
+struct tlb_buffer {
+    void *map;
+    size_t map_size;
+    char *p;
+};
+
+static bool
+tlb_alloc(tlb_buffer *b, size_t size, enum tlb_backing backing)
+{
+    int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+
+    if (backing == TLB_HUGETLB) {
+        b->map_size = size;
+        b->map = mmap(NULL, b->map_size, PROT_READ|PROT_WRITE, flags | MAP_HUGETLB, -1, 0);
+        if (b->map == MAP_FAILED) {
+            return false;
+        }
+        b->p = (char*)b->map;
+    } else {
+        b->map_size = size + HUGE_SIZE;
+        b->map = mmap(NULL, b->map_size, PROT_READ|PROT_WRITE, flags, -1, 0);
+        if (b->map == MAP_FAILED) {
+            return false;
+        }
+        b->p = (char*)(((uintptr_t)b->map + HUGE_SIZE - 1) & ~(uintptr_t)(HUGE_SIZE - 1));
+        madvise(b->p, size, (backing == TLB_THP) ? MADV_HUGEPAGE : MADV_NOHUGEPAGE);
+    }
+
+    memset(b->p, 0, size);
+    return true;
+}
+
+static void
+tlb_free(tlb_buffer *b)
+{
+    munmap(b->map, b->map_size);
+}
+
+/* KernelPageSize of the mapping containing p, and AnonHugePages (THP) in it */
+static void
+smaps_page_size(void *p, long *kernel_page_kb, long *anon_huge_kb)
+{
+    FILE *fp = fopen("/proc/self/smaps", "r");
+    char line[512];
+    bool in = false;
+
+    *kernel_page_kb = -1;
+    *anon_huge_kb = -1;
+
+    if (fp == NULL) {
+        return;
+    }
+
+    while (fgets(line, sizeof(line), fp)) {
+        unsigned long start, end;
+        long v;
+
+        if (sscanf(line, "%lx-%lx ", &start, &end) == 2) {
+            if (in) {
+                break;
+            }
+            in = ((uintptr_t)p >= start && (uintptr_t)p < end);
+        } else if (in) {
+            if (sscanf(line, "KernelPageSize: %ld kB", &v) == 1) {
+                *kernel_page_kb = v;
+            } else if (sscanf(line, "AnonHugePages: %ld kB", &v) == 1) {
+                *anon_huge_kb = v;
+            }
+        }
+    }
+
+    fclose(fp);
+}
+
+/* links one line per page over num_page pages in random order. returns head */
+static void *
+tlb_build_chain(char *p, int num_page)
+{
+    static int order[TLB_MAX_PAGES];
+
+    for (int i=0; i<num_page; i++) {
+        order[i] = i;
+    }
+
+    unsigned int seed = 1;
+    for (int i=num_page-1; i>0; i--) {
+        seed = seed * 1103515245 + 12345;
+        int j = (seed >> 8) % (i+1);
+        int t = order[i];
+        order[i] = order[j];
+        order[j] = t;
+    }
+
+    for (int i=0; i<num_page; i++) {
+        int cur = order[i];
+        int next = order[(i+1) % num_page];
+        void **node = (void**)(p + (size_t)cur * TLB_STRIDE + (cur % 64) * 64);
+        *node = p + (size_t)next * TLB_STRIDE + (next % 64) * 64;
+    }
+
+    return p + (size_t)order[0] * TLB_STRIDE + (order[0] % 64) * 64;
+}
+
+static bool
+run_tlb(enum tlb_backing backing, double *lat)
+{
+    size_t size = (size_t)TLB_MAX_PAGES * TLB_STRIDE;
+    const char *class_name = backing_name[backing];
+    tlb_buffer b;
+    char name[128];
+
+    if (!tlb_alloc(&b, size, backing)) {
+        fprintf(stderr, "tlb : %s backing is not available, skipped\n", class_name);
+        return false;
+    }
+
+    long kernel_page_kb, anon_huge_kb;
+    smaps_page_size(b.p, &kernel_page_kb, &anon_huge_kb);
+
+    /* page size actually obtained */
+    long page_kb = kernel_page_kb;
+    if (anon_huge_kb > 0 && (size_t)anon_huge_kb * 1024 >= size / 2) {
+        page_kb = HUGE_SIZE / 1024;
+    }
+    report_value(class_name, "buffer", "page kB", page_kb);
+    if (anon_huge_kb >= 0) {
+        report_value(class_name, "buffer", "thp coverage", anon_huge_kb * 1024.0 / size);
+    }
+
+    int li = 0;
+    for (int num_page=4; num_page<=TLB_MAX_PAGES; num_page*=2, li++) {
+        void *head = tlb_build_chain(b.p, num_page);
+        double cycle = chase(&head, 1, 1024, 64);
+
+        lt_result r;
+        r.cpi = cycle;
+        r.ipc = 1.0 / cycle;
+        r.upi = -1;
+
+        snprintf(name, sizeof(name), "chase %d pages", num_page);
+        print_result(class_name, name, "latency", r);
+
+        if (lat) {
+            lat[li] = cycle;
+        }
+    }
+
+    tlb_free(&b);
+    return true;
+}
+
+void test_tlb()
+{
+    double lat_4k[32], lat_thp[32];
+    char name[128];
+
+    bool have_4k = run_tlb(TLB_4K, lat_4k);
+    bool have_thp = run_tlb(TLB_THP, lat_thp);
+    run_tlb(TLB_HUGETLB, NULL);
+
+    if (!have_4k || !have_thp) {
+        return;
+    }
+
+    /* page walk cost : extra cycles per load with 4k pages over thp */
+    int li = 0;
+    for (int num_page=4; num_page<=TLB_MAX_PAGES; num_page*=2, li++) {
+        snprintf(name, sizeof(name), "chase %d pages", num_page);
+        report_value("4k-thp", name, "penalty", lat_4k[li] - lat_thp[li]);
+    }
+}
+
+#else
+
+void test_tlb()
+{
+}
+
+#endif
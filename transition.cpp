@@ -0,0 +1,163 @@
+#include "common.hpp"
+
+/*
+ * SSE/AVX transitions
+ *
+ * legacy SSE kernels run with the upper ymm/zmm state set up by a Gen
+ * prologue hook:
+ *
+ *   clean                   : vzeroupper
+ *   dirty ymm               : vbroadcastss ymm0..15 (VEX.256 writes)
+ *   dirty ymm + vzeroupper
+ *   dirty ymm + vzeroall
+ *   dirty zmm               : vbroadcastss zmm0..15 (EVEX.512 writes)
+ *
+ * "penalty" is the cpi difference against clean. On Skylake and later
+ * a dirty upper state makes every SSE write merge into the full
+ * register (false dependency); on Haswell and older it costs one state
+ * save/restore instead, which shows up in the transition kernels:
+ *
+ *   vex128->sse             : vbroadcastss xmm15 ; sse op   (baseline)
+ *   vex256->sse             : vbroadcastss ymm15 ; sse op
+ *   vex256->vzeroupper->sse : vbroadcastss ymm15 ; vzeroupper ; sse op
+ *
+ * The epilogue always runs vzeroupper so the state doesn't leak into
+ * the next test.
+ */
+
+/* rdx is zero_mem (no test here reserves rcx) : keeps addresses out of ib_definition_hash */
+static void
+broadcast_zero(Xbyak::CodeGenerator *g, int bits)
+{
+    for (int i=0; i<16; i++) {
+        if (bits == 512) {
+            g->vbroadcastss(Xbyak::Zmm(i), g->ptr[g->rdx]);
+        } else {
+            g->vbroadcastss(Xbyak::Ymm(i), g->ptr[g->rdx]);
+        }
+    }
+}
+
+static void
+state_clean(Xbyak::CodeGenerator *g)
+{
+    g->vzeroupper();
+}
+
+static void
+state_dirty_ymm(Xbyak::CodeGenerator *g)
+{
+    broadcast_zero(g, 256);
+}
+
+static void
+state_dirty_ymm_vzeroupper(Xbyak::CodeGenerator *g)
+{
+    broadcast_zero(g, 256);
+    g->vzeroupper();
+}
+
+static void
+state_dirty_ymm_vzeroall(Xbyak::CodeGenerator *g)
+{
+    broadcast_zero(g, 256);
+    g->vzeroall();
+}
+
+static void
+state_dirty_zmm(Xbyak::CodeGenerator *g)
+{
+    broadcast_zero(g, 512);
+}
+
+struct upper_state {
+    const char *name;
+    gen_hook_t hook;
+    bool need_avx512;
+};
+
+static const upper_state states[] = {
+    {"clean", state_clean, false},
+    {"dirty ymm", state_dirty_ymm, false},
+    {"dirty ymm + vzeroupper", state_dirty_ymm_vzeroupper, false},
+    {"dirty ymm + vzeroall", state_dirty_ymm_vzeroall, false},
+    {"dirty zmm", state_dirty_zmm, true},
+};
+
+template <typename F>
+static void
+run_states(const char *sse_name, F f, enum operand_type ot)
+{
+    char name[128];
+    double clean_lat = 0, clean_tp = 0;
+
+    for (size_t si=0; si<sizeof(states)/sizeof(states[0]); si++) {
+        const upper_state *s = &states[si];
+        if (s->need_avx512 && !info.have_avx512f) {
+            continue;
+        }
+
+        snprintf(name, sizeof(name), "%s [%s]", sse_name, s->name);
+
+        gen_prologue_hook = s->hook;
+        double lat = lt<Xbyak::Xmm>(name, "latency", f, false, NUM_LOOP, LT_LATENCY, ot).cpi;
+        double tp = lt<Xbyak::Xmm>(name, "throughput", f, false, NUM_LOOP, LT_THROUGHPUT, ot).cpi;
+        gen_prologue_hook = NULL;
+
+        if (si == 0) {
+            clean_lat = lat;
+            clean_tp = tp;
+        } else {
+            report_value("m128", name, "latency penalty", lat - clean_lat);
+            report_value("m128", name, "throughput penalty", tp - clean_tp);
+        }
+    }
+}
+
+#define TRANSITION_STATES(name, expr, ot)                               \
+    run_states(name,                                                    \
+               [](Xbyak::CodeGenerator *g, Xbyak::Xmm dst, Xbyak::Xmm src){expr;}, \
+               ot)
+
+static void
+vzeroupper_hook(Xbyak::CodeGenerator *g)
+{
+    g->vzeroupper();
+}
+
+void test_transition()
+{
+    if (!info.have_avx) {
+        return;
+    }
+
+    gen_epilogue_hook = vzeroupper_hook;
+
+    TRANSITION_STATES("addps", (g->addps(dst, src)), OT_FP32);
+    TRANSITION_STATES("mulps", (g->mulps(dst, src)), OT_FP32);
+    TRANSITION_STATES("paddd", (g->paddd(dst, src)), OT_INT);
+    TRANSITION_STATES("pshufb", (g->pshufb(dst, src)), OT_INT);
+    TRANSITION_STATES("movaps [mem]", (g->movaps(dst, g->ptr[g->rdx])), OT_FP32);
+
+    /* transitions inside the loop. ymm15/xmm15 are not touched by the latency chain (v8) */
+    gen_prologue_hook = state_clean;
+
+    double base = GEN_lt(Xmm, "vex128->sse", "latency",
+                         (g->vbroadcastss(g->xmm15, g->ptr[g->rdx]));(g->addps(dst, src)),
+                         LT_LATENCY, OT_FP32).cpi;
+    double dirty = GEN_lt(Xmm, "vex256->sse", "latency",
+                          (g->vbroadcastss(g->ymm15, g->ptr[g->rdx]));(g->addps(dst, src)),
+                          LT_LATENCY, OT_FP32).cpi;
+    double vzu = GEN_lt(Xmm, "vex256->vzeroupper->sse", "latency",
+                        (g->vbroadcastss(g->ymm15, g->ptr[g->rdx]));(g->vzeroupper());(g->addps(dst, src)),
+                        LT_LATENCY, OT_FP32).cpi;
+
+    report_value("m128", "vex256->sse", "transition", dirty - base);
+    report_value("m128", "vex256->vzeroupper->sse", "transition", vzu - base);
+
+    GEN_throughput_only(Xmm, "vzeroupper", (g->vzeroupper()), false, OT_FP32);
+    GEN_throughput_only(Xmm, "vzeroall", (g->vzeroall()), false, OT_FP32);
+
+    gen_prologue_hook = NULL;
+    gen_epilogue_hook = NULL;
+}